@@ -5,10 +5,11 @@
 using namespace std;
 
 #include <mcts.h>
+#include <mcts_book.h>
 
 #include "connect_four.h"
 
-void main_program()
+void main_program(const char* book_file)
 {
 	using namespace std;
 
@@ -21,12 +22,24 @@ void main_program()
 	player2_options.verbose = true;
 
 	ConnectFourState state;
+
+	std::unique_ptr<MCTS::PositionBook<ConnectFourState::Move>> book;
+	if (book_file != nullptr) {
+		book.reset(new MCTS::PositionBook<ConnectFourState::Move>(book_file));
+	}
+	auto compute_move = [&book](const ConnectFourState& state, const MCTS::ComputeOptions& options)
+	{
+		if (book) {
+			return MCTS::compute_move_with_book(state, *book, options);
+		}
+		return MCTS::compute_move(state, options);
+	};
 	while (state.has_moves()) {
 		cout << endl << "State: " << state << endl;
 
 		ConnectFourState::Move move = ConnectFourState::no_move;
 		if (state.player_to_move == 1) {
-			move = MCTS::compute_move(state, player1_options);
+			move = compute_move(state, player1_options);
 			state.do_move(move);
 		}
 		else {
@@ -45,7 +58,7 @@ void main_program()
 				}
 			}
 			else {
-				move = MCTS::compute_move(state, player2_options);
+				move = compute_move(state, player2_options);
 				state.do_move(move);
 			}
 		}
@@ -64,10 +77,11 @@ void main_program()
 	}
 }
 
-int main()
+int main(int argc, char* argv[])
 {
 	try {
-		main_program();
+		// An optional position book built with opening_book.
+		main_program(argc > 1 ? argv[1] : nullptr);
 	}
 	catch (std::runtime_error& error) {
 		std::cerr << "ERROR: " << error.what() << std::endl;
@@ -92,6 +92,15 @@ public:
 		return moves;
 	}
 
+	std::uint64_t get_hash() const
+	{
+		auto hash = MCTS::hash_bytes(&player_to_move, sizeof(player_to_move));
+		for (auto& row: board) {
+			hash = MCTS::hash_bytes(row.data(), row.size(), hash);
+		}
+		return hash;
+	}
+
 	char get_winner() const
 	{
 		if (last_col < 0) {
@@ -48,7 +48,7 @@ class GoApp: public AppBasic
 	std::string error_string;
 
 	// Compute move.
-	std::future<State::Move> computed_move;
+	MCTS::SearchHandle<State> search;
 	void next_player();
 	void start_compute_move();
 	void check_for_computed_move();
@@ -104,20 +104,7 @@ void GoApp::start_compute_move()
 		options = player2_options;
 	}
 
-	auto state_copy = state;
-	computed_move = 
-		std::async(std::launch::async,
-			[state_copy, options]() 
-			{ 
-				auto best_move = MCTS::compute_move(state_copy, options);
-				return best_move;
-
-				//// Single-threaded.
-				//auto tree = MCTS::compute_tree(state_copy, options, 1241 * std::time(0));
-				//typedef MCTS::Node<State> Node;
-				//auto best_child = *std::max_element( tree->children.begin(), tree->children.end(), [](Node* lhs, Node* rhs) { return lhs->visits < rhs->visits; } );
-				//return best_child->move;
-			});
+	search.start(state, options);
 }
 
 void GoApp::check_for_computed_move()
@@ -128,10 +115,9 @@ void GoApp::check_for_computed_move()
 		return;
 	}
 
-	auto status = computed_move.wait_for(std::chrono::seconds(0));
-	if (status == std::future_status::ready) {
+	if (search.is_finished()) {
 		try {
-			auto move = computed_move.get();
+			auto move = search.wait();
 			state.do_move(move);
 
 			// Are there any more moves possible?
@@ -209,6 +195,8 @@ void GoApp::keyDown( KeyEvent event )
 		}
 	}
 	else if (event.getChar() == 'r') {
+		// The running search, if any, is abandoned.
+		search.stop();
 		state = State();
 		setup();
 	}
@@ -293,7 +281,7 @@ void GoApp::draw()
 	sout << "Player 1 (black) score: " << state.get_player_score(1) << endl;
 	sout << "Player 2 (white) score: " << state.get_player_score(2) << endl;
 
-	//sout << "Board hash: " << state.previous_board_hash_value << " -> " << state.compute_hash_value() << endl;
+	//sout << "Board hash: " << state.compute_hash_value() << endl;
 	//for (auto move: state.get_moves()) {
 	//	sout << move << " ";
 	//}
@@ -2,30 +2,104 @@
 // petter.strandmark@gmail.com
 
 #include <algorithm>
+#include <cstdint>
+#include <fstream>
 #include <iostream>
 #include <utility>
 
 #include <mcts.h>
 
-template<unsigned int M, unsigned int N>
-class GoState
+// The Zobrist key of a stone of player (1 or 2) at a point, and 0 for
+// an empty point. The hash of a board is the exclusive or of the keys of
+// its stones, so it can be updated for every stone that is placed or
+// removed. The keys are computed (with the SplitMix64 finalizer) instead
+// of stored, so all board sizes and threads share them without tables.
+inline std::uint64_t go_zobrist_key(int point, int player)
+{
+	if (player == 0) {
+		return 0;
+	}
+	std::uint64_t z = 0x9E3779B97F4A7C15ull * std::uint64_t(2 * point + player);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+
+// The board hashes of the most recent moves, for the ko rule. Only
+// repetitions within the last length moves are detected. That covers
+// the cycles of real games (a triple ko repeats after six moves) and
+// keeps the size of a state independent of the length of the game.
+class GoHashHistory
 {
 public:
+	static const int length = 64;
+
+	GoHashHistory() :
+		size(0),
+		next(0)
+	{ }
+
+	void insert(std::uint64_t hash)
+	{
+		hashes[next] = hash;
+		next = (next + 1) % length;
+		if (size < length) {
+			size++;
+		}
+	}
+
+	bool contains(std::uint64_t hash) const
+	{
+		for (int k = 0; k < size; ++k) {
+			if (hashes[k] == hash) {
+				return true;
+			}
+		}
+		return false;
+	}
 
-	// Mutable because is_move_possible temporary modifies
-	// the board.
-	mutable unsigned char board[M][N];
-	unsigned int previous_board_hash_value;
-	std::set<unsigned int> all_hash_values;
-	
+private:
+	std::uint64_t hashes[length];
+	int size;
+	int next;
+};
+
+//
+// The rules of Go on an M x N board. Variants derive from GoStateBase
+// with themselves as Derived (the curiously recurring template pattern)
+// and may redefine do_move, get_moves, has_moves and get_result. There
+// are no virtual functions, so the search can inline everything.
+//
+// Derived types may also define point_changed(i, j), which is called
+// after every change of a point on the board. It is not called by the
+// default constructor, which starts from an empty board.
+//
+// A game ends after max_depth moves even if there are legal moves left,
+// and the board is then scored as it stands. This bounds the length of
+// the random games of the search on large boards.
+//
+template<typename Derived, unsigned int M, unsigned int N>
+class GoStateBase
+{
+public:
+
+	unsigned char board[M][N];
+	// The hashes of the boards after each move, before any captures.
+	GoHashHistory hash_history;
 
 public:
 	static const unsigned char empty = 0;
 	static const unsigned char player1 = 1;
 	static const unsigned char player2 = 2;
+	static const int rows = M;
+	static const int columns = N;
+	static const int max_depth = 3 * M * N > 1000 ? 3 * M * N : 1000;
 
-	mutable int depth;
+	int depth;
 	int player_to_move;
+	// Added to the score of player 2 by get_result, which the search
+	// maximizes.
+	double komi;
 	typedef int Move;
 	static const Move no_move;
 	static const Move pass;
@@ -43,26 +117,22 @@ public:
 	}
 
 
-	GoState():
+protected:
+	GoStateBase():
+		depth(0),
 		player_to_move(1),
-		previous_board_hash_value(0),
-		depth(0)
+		komi(0)
 	{ 
-		all_hash_values.insert(compute_hash_value());
-
-		for (int i = 0; i < M; ++i) {
-			for (int j = 0; j < N; ++j) {
-				board[i][j] =  empty;
-			}
-		}
+		clear_board();
+		hash_history.insert(compute_hash_value());
 	}
 
-	GoState(char board[M][N+1]):
+	GoStateBase(char board[M][N+1]):
+		depth(0),
 		player_to_move(1),
-		previous_board_hash_value(0),
-		depth(0)
+		komi(0)
 	{
-		GoState<M, N> state;
+		clear_board();
 		for (int i = 0; i < M; ++i) {
 		for (int j = 0; j < N; ++j) {
 			if (board[i][j] == '1') {
@@ -77,98 +147,105 @@ public:
 		}}
 	}
 
-	virtual ~GoState() { }
+	Derived& derived()
+	{
+		return static_cast<Derived&>(*this);
+	}
+
+	const Derived& derived() const
+	{
+		return static_cast<const Derived&>(*this);
+	}
+
+	void point_changed(int i, int j)
+	{ }
 
-	virtual unsigned char get_pos(int i, int j) const
+public:
+	unsigned char get_pos(int i, int j) const
 	{
 		attest(ij_to_ind(i, j) >= 0);
 		return board[i][j];
 	}
 
-	virtual void set_pos(int i, int j, unsigned char player)
+	void set_pos(int i, int j, unsigned char player)
 	{
 		attest(ij_to_ind(i, j) >= 0);
-		board[i][j] = player;
+		change_point(i, j, player);
 	}
 
-	virtual unsigned int compute_hash_value() const
+	std::uint64_t compute_hash_value() const
 	{
-		unsigned int value = 0;
-		for (int i = 0; i < M; ++i) {
-		for (int j = 0; j < N; ++j) {
-			value = 65537 * value + board[i][j];
-		}}
-		return value;
+		return board_hash;
 	}
 
-	virtual bool is_move_possible(int i, int j) const
+	// The hash value if the empty point (stone_i, stone_j) had a stone
+	// of player.
+	std::uint64_t compute_hash_value(int stone_i, int stone_j, int player) const
 	{
-		return is_move_possible(i, j, player_to_move);
+		attest(board[stone_i][stone_j] == empty);
+		return board_hash ^ go_zobrist_key(N*stone_i + stone_j, player);
 	}
 
-	virtual bool is_move_possible(const int i, const int j, const int player) const
+	// Hash of the position for opening books. Unlike compute_hash_value,
+	// it includes the player to move. The ko history is not included.
+	std::uint64_t get_hash() const
 	{
-		const int opponent = 3 - player;
+		auto hash = MCTS::hash_bytes(board, sizeof(board));
+		return MCTS::hash_bytes(&player_to_move, sizeof(player_to_move), hash);
+	}
 
-		if (0 <= i && i < M && 0 <= j && j < N) {
-			if (board[i][j] != empty) {
-				return false;
-			}
+	bool is_move_possible(int i, int j) const
+	{
+		return is_move_possible(i, j, player_to_move);
+	}
 
-			// See if it is possible to move into this empty place.
-			std::set<std::pair<int, int>> pieces;
-			board[i][j] = player;
+	// Does not modify the state, so several threads may call it at the
+	// same time.
+	bool is_move_possible(const int i, const int j, const int player) const
+	{
+		if (i < 0 || i >= M || j < 0 || j >= N || board[i][j] != empty) {
+			return false;
+		}
+
+		// Not possible to play in one's own eye.
+		if (is_eye(i, j, player)) {
+			return false;
+		}
 
-			bool possible = false;
-			if (is_alive(i, j, &pieces)) {
-				// This stone is immediately alive.
+		// The new stone is alive if it has an empty neighbor, joins a
+		// group of its own with another liberty or captures a group of
+		// the opponent, whose only liberty it then takes.
+		const int neighbors[4][2] = {{i - 1, j}, {i + 1, j}, {i, j - 1}, {i, j + 1}};
+		bool possible = false;
+		for (auto& neighbor: neighbors) {
+			const int ni = neighbor[0];
+			const int nj = neighbor[1];
+			if (ni < 0 || ni >= M || nj < 0 || nj >= N) {
+				continue;
+			}
+			if (board[ni][nj] == empty) {
 				possible = true;
 			}
-			else {
-				// This stone may have killed opponents so
-				// that it is alive.
-
-				if (i > 0 && board[i - 1][j] == opponent && !is_alive(i - 1, j, &pieces)) {
-					possible = true;
-				}
-				else if (i < M - 1 && board[i + 1][j] == opponent && !is_alive(i + 1, j, &pieces)) {
-					possible = true;
-				}
-				else if (j > 0 && board[i][j - 1] == opponent && !is_alive(i, j - 1, &pieces)) {
-					possible = true;
-				}
-				else if (j < N - 1 && board[i][j + 1] == opponent && !is_alive(i, j + 1, &pieces)) {
-					possible = true;
-				}
+			else if (board[ni][nj] == player) {
+				possible = possible || has_liberty_except(ni, nj, i, j);
 			}
-
-			if (possible) {
-				// Ko rule tests.
-				if (compute_hash_value() == previous_board_hash_value) {			
-					possible = false;
-				}
-				else if (all_hash_values.find(compute_hash_value()) != all_hash_values.end()) {
-					possible = false;
-				}
+			else {
+				possible = possible || ! has_liberty_except(ni, nj, i, j);
 			}
-
 			if (possible) {
-				// Not possible to play in one's own eye.
-				if (is_eye(i, j, player)) {
-					possible = false;
-				}
+				break;
 			}
-
-			board[i][j] = empty;
-			return possible;
 		}
-		else {
-			// Not a valid position.
+		if ( ! possible) {
 			return false;
 		}
+
+		// Ko rule tests. The hashes are those of the boards after the
+		// stones were placed, before any captures.
+		return ! hash_history.contains(compute_hash_value(i, j, player));
 	}
 
-	virtual bool is_eye(int i, int j, int player) const
+	bool is_eye(int i, int j, int player) const
 	{
 		bool eye = true;
 		if (i > 0 && board[i - 1][j] != player) eye = false;
@@ -178,7 +255,7 @@ public:
 		return eye;
 	}
 
-	virtual void do_move(Move move)
+	void do_move(Move move)
 	{
 		depth++;
 
@@ -193,12 +270,11 @@ public:
 		std::tie(i, j) = ind_to_ij(move);
 		attest(is_move_possible(i, j));
 
-		board[i][j] = player_to_move;
+		change_point(i, j, player_to_move);
 
 		// We save the hash values before all captures as this is way easier
 		// to check.
-		previous_board_hash_value = compute_hash_value();
-		all_hash_values.insert(previous_board_hash_value);
+		hash_history.insert(compute_hash_value());
 
 		// Check for the killing of any opposing stones.
 		if (i > 0 && board[i - 1][j] == opponent) {
@@ -223,7 +299,7 @@ public:
 		player_to_move = opponent;
 	}
 
-	virtual bool is_alive(int i_start, int j_start, std::set<std::pair<int, int>>* pieces) const
+	bool is_alive(int i_start, int j_start, std::set<std::pair<int, int>>* pieces) const
 	{
 		if (board[i_start][j_start] == empty) {
 			// No piece here, so alive
@@ -272,7 +348,7 @@ public:
 		return false;
 	}
 
-	virtual void check_alive(int i, int j)
+	void check_alive(int i, int j)
 	{
 		std::set<std::pair<int, int>> pieces;
 		if (!is_alive(i, j, &pieces)) {
@@ -280,7 +356,7 @@ public:
 			for (auto& ij: pieces) {
 				int i, j;
 				std::tie(i, j) = ij;
-				board[i][j] = empty;
+				change_point(i, j, empty);
 			}
 		}
 	}
@@ -288,24 +364,56 @@ public:
 	template<typename RandomEngine>
 	void do_random_move(RandomEngine* engine)
 	{
-		auto moves = get_moves();
+		// Try random empty points first. Only legal moves are accepted,
+		// so the move is uniformly distributed among them.
+		const int player = player_to_move;
+		if (open_points[player] > 0) {
+			std::uniform_int_distribution<int> point_ind(0, number_of_empty_points - 1);
+			for (int attempt = 0; attempt < number_of_empty_points; ++attempt) {
+				auto move = empty_points[point_ind(*engine)];
+				int i = move / N;
+				int j = move % N;
+				if (is_open(i, j, player) && is_move_possible(i, j, player)) {
+					derived().do_move(move);
+					return;
+				}
+			}
+		}
+
+		// Most points are illegal (or the player has to pass).
+		auto moves = derived().get_moves();
 		attest(! moves.empty());
 		std::uniform_int_distribution<std::size_t> move_ind(0, moves.size() - 1);
 		auto move = moves[move_ind(*engine)];
-		do_move(move);
+		derived().do_move(move);
 	}
 
-	virtual bool has_moves() const
+	// Same as ! get_moves().empty(), but stops at the first legal move.
+	bool has_moves() const
 	{
-		// TODO: make faster.
-		return ! get_moves().empty();
+		if (depth >= max_depth) {
+			return false;
+		}
+
+		const int players[2] = {player_to_move, 3 - player_to_move};
+		for (int player: players) {
+			if (open_points[player] == 0) {
+				continue;
+			}
+			for (int i = 0; i < M; ++i) {
+			for (int j = 0; j < N; ++j) {
+				if (is_open(i, j, player) && is_move_possible(i, j, player)) {
+					return true;
+				}
+			}}
+		}
+		return false;
 	}
 
-	virtual std::vector<Move> get_moves() const
+	std::vector<Move> get_moves() const
 	{
 		std::vector<Move> moves;
-		if (depth > 1000) {
-			attest(false);
+		if (depth >= max_depth) {
 			return moves;
 		}
 
@@ -328,27 +436,71 @@ public:
 		return moves;
 	}
 
-	virtual int get_player_score(int player) const
+	// Area scoring (Tromp-Taylor): the stones of a player plus the empty
+	// regions that only border stones of that player. scores[1] and
+	// scores[2] are set. Only the empty regions need to be visited.
+	void get_scores(int scores[3]) const
 	{
-		int score = 0;
-		for (int i = 0; i < M; ++i) {
-		for (int j = 0; j < N; ++j) {
-			if (board[i][j] == empty) {
-				if (is_eye(i, j, player)) {
-					score++;
+		scores[0] = 0;
+		scores[1] = number_of_stones[1];
+		scores[2] = number_of_stones[2];
+
+		bool visited[M * N] = {};
+		short stack[M * N];
+		for (int k = 0; k < number_of_empty_points; ++k) {
+			if (visited[empty_points[k]]) {
+				continue;
+			}
+
+			int region_size = 0;
+			bool borders[4] = {false, false, false, false};
+			int stack_size = 0;
+			stack[stack_size++] = empty_points[k];
+			visited[empty_points[k]] = true;
+			while (stack_size > 0) {
+				int p = stack[--stack_size];
+				int i = p / N;
+				int j = p % N;
+				region_size++;
+				int neighbors[4][2] = {{i - 1, j}, {i + 1, j}, {i, j - 1}, {i, j + 1}};
+				for (auto& neighbor: neighbors) {
+					int ni = neighbor[0];
+					int nj = neighbor[1];
+					if (ni < 0 || ni >= M || nj < 0 || nj >= N) {
+						continue;
+					}
+					if (board[ni][nj] != empty) {
+						borders[board[ni][nj]] = true;
+					}
+					else if ( ! visited[N*ni + nj]) {
+						visited[N*ni + nj] = true;
+						stack[stack_size++] = N*ni + nj;
+					}
 				}
 			}
-			if (board[i][j] == player) {
-				score++;
+
+			if (borders[1] && ! borders[2]) {
+				scores[1] += region_size;
 			}
-		}}
-		return score;
+			else if (borders[2] && ! borders[1]) {
+				scores[2] += region_size;
+			}
+		}
 	}
 
-	virtual double get_result(int current_player_to_move) const
+	int get_player_score(int player) const
 	{
-		int score1 = get_player_score(1);
-		int score2 = get_player_score(2);
+		int scores[3];
+		get_scores(scores);
+		return scores[player];
+	}
+
+	double get_result(int current_player_to_move) const
+	{
+		int scores[3];
+		get_scores(scores);
+		double score1 = scores[1];
+		double score2 = scores[2] + komi;
 
 		if (score1 == score2) {
 			return 0.5;
@@ -369,7 +521,7 @@ public:
 		}
 	}
 
-	virtual void dump_board(const char* file_name) const
+	void dump_board(const char* file_name) const
 	{
 		std::ofstream fout(file_name);
 		fout << "static const int M = " << M << ";" << std::endl;
@@ -385,10 +537,148 @@ public:
 		}
 		fout << "};" << std::endl;
 	}
+
+private:
+	// Whether the group at (i_start, j_start) has an empty neighbor
+	// other than (except_i, except_j).
+	bool has_liberty_except(int i_start, int j_start, int except_i, int except_j) const
+	{
+		const int player = board[i_start][j_start];
+		bool visited[M * N] = {};
+		short stack[M * N];
+		int stack_size = 0;
+		stack[stack_size++] = N*i_start + j_start;
+		visited[N*i_start + j_start] = true;
+		while (stack_size > 0) {
+			int p = stack[--stack_size];
+			int i = p / N;
+			int j = p % N;
+			const int neighbors[4][2] = {{i - 1, j}, {i + 1, j}, {i, j - 1}, {i, j + 1}};
+			for (auto& neighbor: neighbors) {
+				const int ni = neighbor[0];
+				const int nj = neighbor[1];
+				if (ni < 0 || ni >= M || nj < 0 || nj >= N || visited[N*ni + nj]) {
+					continue;
+				}
+				if (board[ni][nj] == empty) {
+					if (ni != except_i || nj != except_j) {
+						return true;
+					}
+				}
+				else if (board[ni][nj] == player) {
+					visited[N*ni + nj] = true;
+					stack[stack_size++] = N*ni + nj;
+				}
+			}
+		}
+		return false;
+	}
+
+	// Whether a point is empty and not an eye of player. Only such
+	// points can be legal moves.
+	bool is_open(int i, int j, int player) const
+	{
+		return board[i][j] == empty && ! is_eye(i, j, player);
+	}
+
+	void clear_board()
+	{
+		for (int i = 0; i < M; ++i) {
+			for (int j = 0; j < N; ++j) {
+				board[i][j] =  empty;
+			}
+		}
+		open_points[0] = 0;
+		open_points[1] = open_points[2] = M * N > 1 ? M * N : 0;
+		for (int p = 0; p < M * N; ++p) {
+			empty_points[p] = p;
+			empty_point_index[p] = p;
+		}
+		number_of_empty_points = M * N;
+		number_of_stones[0] = number_of_stones[1] = number_of_stones[2] = 0;
+		board_hash = 0;
+	}
+
+	// Sets a point and updates open_points for it and its neighbors,
+	// the only points whose status can change, and the empty points.
+	void change_point(int i, int j, unsigned char value)
+	{
+		const int p = N*i + j;
+		board_hash ^= go_zobrist_key(p, board[i][j]) ^ go_zobrist_key(p, value);
+		number_of_stones[board[i][j]]--;
+		number_of_stones[value]++;
+		if (board[i][j] == empty && value != empty) {
+			// Move the last empty point into the place of this one.
+			auto last = empty_points[--number_of_empty_points];
+			empty_points[empty_point_index[p]] = last;
+			empty_point_index[last] = empty_point_index[p];
+		}
+		else if (board[i][j] != empty && value == empty) {
+			empty_points[number_of_empty_points] = p;
+			empty_point_index[p] = number_of_empty_points++;
+		}
+
+		int points[5][2] = {{i, j}, {i - 1, j}, {i + 1, j}, {i, j - 1}, {i, j + 1}};
+		for (auto& point: points) {
+			if (0 <= point[0] && point[0] < M && 0 <= point[1] && point[1] < N) {
+				open_points[1] -= is_open(point[0], point[1], 1);
+				open_points[2] -= is_open(point[0], point[1], 2);
+			}
+		}
+		board[i][j] = value;
+		for (auto& point: points) {
+			if (0 <= point[0] && point[0] < M && 0 <= point[1] && point[1] < N) {
+				open_points[1] += is_open(point[0], point[1], 1);
+				open_points[2] += is_open(point[0], point[1], 2);
+			}
+		}
+
+		derived().point_changed(i, j);
+	}
+
+	// The number of open points of each player (index 1 and 2).
+	int open_points[3];
+
+	// The first number_of_empty_points elements of empty_points are the
+	// empty points, as indices i*N + j. empty_point_index is the
+	// position of a point in empty_points if it is empty.
+	short empty_points[M * N];
+	short empty_point_index[M * N];
+	int number_of_empty_points;
+
+	// The number of stones of each player (index 1 and 2). Index 0 is
+	// not used.
+	int number_of_stones[3];
+
+	// The exclusive or of go_zobrist_key of all stones.
+	std::uint64_t board_hash;
 };
 
-template<unsigned int M, unsigned int N>
-const typename GoState<M, N>::Move GoState<M, N>::no_move = -2;
+template<typename Derived, unsigned int M, unsigned int N>
+const unsigned char GoStateBase<Derived, M, N>::empty;
+template<typename Derived, unsigned int M, unsigned int N>
+const unsigned char GoStateBase<Derived, M, N>::player1;
+template<typename Derived, unsigned int M, unsigned int N>
+const unsigned char GoStateBase<Derived, M, N>::player2;
+template<typename Derived, unsigned int M, unsigned int N>
+const int GoStateBase<Derived, M, N>::max_depth;
+
+template<typename Derived, unsigned int M, unsigned int N>
+const typename GoStateBase<Derived, M, N>::Move GoStateBase<Derived, M, N>::no_move = -2;
 
+template<typename Derived, unsigned int M, unsigned int N>
+const typename GoStateBase<Derived, M, N>::Move GoStateBase<Derived, M, N>::pass = -1;
+
+// Go with the standard rules.
 template<unsigned int M, unsigned int N>
-const typename GoState<M, N>::Move GoState<M, N>::pass = -1;
+class GoState:
+	public GoStateBase<GoState<M, N>, M, N>
+{
+public:
+	GoState()
+	{ }
+
+	GoState(char board[M][N+1]):
+		GoStateBase<GoState<M, N>, M, N>(board)
+	{ }
+};
@@ -7,10 +7,16 @@
 
 #include <mcts.h>
 
+// Go where five stones in a row or column win.
 template<unsigned int M, unsigned int N>
 class Go5RowState:
-	public GoState<M, N>
+	public GoStateBase<Go5RowState<M, N>, M, N>
 {
+	typedef GoStateBase<Go5RowState<M, N>, M, N> Base;
+
+public:
+	typedef typename Base::Move Move;
+
 private:
 	int last_row, last_col;
 
@@ -22,9 +28,9 @@ public:
 		last_col(-1)
 	{ }
 
-	virtual void do_move(Move move)
+	void do_move(Move move)
 	{
-		GoState::do_move(move);
+		Base::do_move(move);
 		
 		/*
 		if (move == pass) {
@@ -39,17 +45,18 @@ public:
 		*/
 
 		if (move >= 0) {
-			std::tie(last_row, last_col) = ind_to_ij(move);
+			std::tie(last_row, last_col) = Base::ind_to_ij(move);
 		}
 		else {
 			last_row = last_col = -1;
 		}
 	}
 
-	virtual unsigned char get_winner() const
+	unsigned char get_winner() const
 	{
+		auto& board = this->board;
 		if (last_row < 0) {
-			return empty;
+			return Base::empty;
 		}
 
 		// We only need to check around the last piece played.
@@ -74,7 +81,7 @@ public:
 			return piece;
 		}
 
-		return empty;
+		return Base::empty;
 	}
 
 	/*
@@ -122,21 +129,26 @@ public:
 	}
 	*/
 
-	virtual std::vector<Move> get_moves() const
+	bool has_moves() const
+	{
+		return get_winner() == Base::empty && Base::has_moves();
+	}
+
+	std::vector<Move> get_moves() const
 	{	
 		//get_moves_internal();
 		//return scratch;
 
-		if (get_winner() != empty) {
+		if (get_winner() != Base::empty) {
 			return std::vector<Move>();
 		}
-		return GoState::get_moves();
+		return Base::get_moves();
 	}
 
-	virtual double get_result(int current_player_to_move) const
+	double get_result(int current_player_to_move) const
 	{
 		auto winner = get_winner();
-		if (winner == empty) {
+		if (winner == Base::empty) {
 			return 0.5;
 		}
 
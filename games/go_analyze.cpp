@@ -0,0 +1,241 @@
+// Offline analysis of Go game records. Reads SGF files, directories of
+// SGF files or a stream of games on standard input and searches every
+// position of the main line with a fixed number of iterations. One line
+// of tab-separated values is written for every position:
+//
+//   file  game  move  player  played  best  best_win_rate  played_win_rate  games
+//
+// where the win rates are for the player to move, with the komi of the
+// game. Games are read one at a time and searched in batches of at most
+// --batch positions, whose lines are written as soon as the batch is
+// done, so any number of games can be analyzed in bounded memory.
+// Games that cannot be replayed are reported on stderr and skipped.
+//
+// Note that GoState does not allow filling one's own eyes, so games
+// with such moves are skipped.
+//
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#ifndef _WIN32
+	#include <dirent.h>
+	#include <sys/stat.h>
+#endif
+
+#include <mcts.h>
+
+#include "go.h"
+#include "go_sgf.h"
+
+static const char* column_letters = "ABCDEFGHJKLMNOPQRSTUVWXYZ";
+
+template<typename State>
+string move_to_string(typename State::Move move)
+{
+	if (move == State::pass) {
+		return "pass";
+	}
+	auto ij = State::ind_to_ij(move);
+	stringstream sout;
+	sout << column_letters[ij.second] << State::rows - ij.first;
+	return sout.str();
+}
+
+template<typename Move>
+string win_rate(const MCTS::RootStatistics<Move>& statistics, Move move)
+{
+	auto itr = statistics.find(move);
+	if (itr == statistics.end() || itr->second.first == 0) {
+		return "-";
+	}
+	stringstream sout;
+	sout << fixed << setprecision(3) << itr->second.second / itr->second.first;
+	return sout.str();
+}
+
+struct AnalyzeOptions
+{
+	MCTS::ComputeOptions search;
+	// The number of positions searched together. Batches keep the
+	// threads busy even for short searches.
+	int batch_size;
+};
+
+template<int Size>
+void analyze_game(const string& name, int game_number, const SgfGame& game, const AnalyzeOptions& options)
+{
+	typedef GoState<Size, Size> State;
+	typedef typename State::Move Move;
+
+	auto positions = replay_sgf_game<State>(game);
+
+	vector<size_t> searched_moves;
+	for (size_t k = 0; k < game.moves.size(); ++k) {
+		if (positions[k].has_moves()) {
+			searched_moves.push_back(k);
+		}
+	}
+
+	for (size_t start = 0; start < searched_moves.size(); start += options.batch_size) {
+		size_t end = min(searched_moves.size(), start + options.batch_size);
+		vector<State> searched_states;
+		for (size_t s = start; s < end; ++s) {
+			searched_states.push_back(positions[searched_moves[s]]);
+		}
+
+		vector<long long> games_played;
+		auto statistics = MCTS::compute_root_statistics(searched_states, options.search, &games_played);
+
+		for (size_t s = start; s < end; ++s) {
+			auto& move = game.moves[searched_moves[s]];
+			auto& position_statistics = statistics[s - start];
+			Move played = move.i < 0 ? State::pass : State::ij_to_ind(move.i, move.j);
+			Move best = MCTS::best_move_from_statistics(position_statistics, games_played[s - start], false);
+			cout << name << "\t"
+			     << game_number << "\t"
+			     << searched_moves[s] + 1 << "\t"
+			     << (move.player == 1 ? "B" : "W") << "\t"
+			     << move_to_string<State>(played) << "\t"
+			     << move_to_string<State>(best) << "\t"
+			     << win_rate(position_statistics, best) << "\t"
+			     << win_rate(position_statistics, played) << "\t"
+			     << games_played[s - start] << "\n";
+		}
+		cout.flush();
+	}
+}
+
+void analyze_stream(const string& name, istream& in, const AnalyzeOptions& options)
+{
+	SgfGame game;
+	for (int game_number = 1; ; ++game_number) {
+		try {
+			if ( ! read_sgf_game(in, &game)) {
+				return;
+			}
+		}
+		catch (std::runtime_error& error) {
+			// The start of the next game can not be found reliably after
+			// a syntax error.
+			cerr << name << ", game " << game_number << ": " << error.what() << endl;
+			return;
+		}
+
+		try {
+			switch (game.size) {
+				case 5:  analyze_game<5>(name, game_number, game, options); break;
+				case 7:  analyze_game<7>(name, game_number, game, options); break;
+				case 9:  analyze_game<9>(name, game_number, game, options); break;
+				case 11: analyze_game<11>(name, game_number, game, options); break;
+				case 13: analyze_game<13>(name, game_number, game, options); break;
+				case 19: analyze_game<19>(name, game_number, game, options); break;
+				default: throw runtime_error("unsupported board size " + to_string(game.size) + ".");
+			}
+		}
+		catch (std::runtime_error& error) {
+			cerr << name << ", game " << game_number << ": " << error.what() << endl;
+		}
+	}
+}
+
+void analyze_file(const string& file_name, const AnalyzeOptions& options)
+{
+	ifstream fin(file_name);
+	if ( ! fin) {
+		cerr << "Could not open " << file_name << endl;
+		return;
+	}
+	analyze_stream(file_name, fin, options);
+}
+
+// Analyzes the .sgf files of a directory in name order. Returns false
+// if path is not a directory.
+bool analyze_directory(const string& path, const AnalyzeOptions& options)
+{
+	#ifdef _WIN32
+		return false;
+	#else
+		struct stat info;
+		if (stat(path.c_str(), &info) != 0 || ! S_ISDIR(info.st_mode)) {
+			return false;
+		}
+		DIR* directory = opendir(path.c_str());
+		if ( ! directory) {
+			return false;
+		}
+		vector<string> file_names;
+		while (dirent* entry = readdir(directory)) {
+			string name = entry->d_name;
+			if (name.size() > 4 && name.substr(name.size() - 4) == ".sgf") {
+				file_names.push_back(path + "/" + name);
+			}
+		}
+		closedir(directory);
+
+		sort(file_names.begin(), file_names.end());
+		for (auto& file_name: file_names) {
+			analyze_file(file_name, options);
+		}
+		return true;
+	#endif
+}
+
+int main(int argc, char* argv[])
+{
+	AnalyzeOptions options;
+	options.search.max_iterations = 10000;
+	options.search.number_of_threads = int(thread::hardware_concurrency());
+	if (options.search.number_of_threads <= 0) {
+		options.search.number_of_threads = 8;
+	}
+	options.batch_size = 16;
+	vector<string> paths;
+
+	for (int i = 1; i < argc; ++i) {
+		string arg = argv[i];
+		if (arg == "--iterations" && i + 1 < argc) {
+			options.search.max_iterations = atoi(argv[++i]);
+		}
+		else if (arg == "--threads" && i + 1 < argc) {
+			options.search.number_of_threads = atoi(argv[++i]);
+		}
+		else if (arg == "--batch" && i + 1 < argc) {
+			options.batch_size = max(1, atoi(argv[++i]));
+		}
+		else if (arg.size() > 2 && arg.substr(0, 2) == "--") {
+			cerr << "Usage: " << argv[0] << " [--iterations n] [--threads n] [--batch n] [file or directory ...]" << endl
+			     << "  --iterations: iterations per thread and position (default 10000)." << endl
+			     << "  --threads:    default is the number of cores." << endl
+			     << "  --batch:      positions searched together (default 16)." << endl
+			     << "  Reads games from standard input if no files are given or for -." << endl
+			     << "  Board sizes 5, 7, 9, 11, 13 and 19 are supported." << endl;
+			return 1;
+		}
+		else {
+			paths.push_back(arg);
+		}
+	}
+
+	cout << "file\tgame\tmove\tplayer\tplayed\tbest\tbest_win_rate\tplayed_win_rate\tgames\n";
+	if (paths.empty()) {
+		paths.push_back("-");
+	}
+	for (auto& path: paths) {
+		if (path == "-") {
+			analyze_stream(path, cin, options);
+		}
+		else if ( ! analyze_directory(path, options)) {
+			analyze_file(path, options);
+		}
+	}
+}
@@ -0,0 +1,557 @@
+// Go on bitboards. The rules are the same as for GoState (go.h),
+// including which moves are legal and the order of get_moves, but the
+// board is stored as one bit set per player. Groups, liberties, eyes and
+// territories are found with shifts and bitwise operations on 64-bit
+// words, a few words at a time.
+//
+// Include go.h before this file.
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <mcts.h>
+
+//
+// A set of points of an M x N board. Point (i, j) is bit i*(N + 1) + j,
+// so rows are separated by a bit that is never set and shifting by one
+// bit never moves a point from one row to the next. Up to 19x19 fits in
+// six words.
+//
+template<unsigned int M, unsigned int N>
+class GoBitboard
+{
+public:
+	static const int stride = N + 1;
+	static const int number_of_bits = M * stride;
+	static const int number_of_words = (number_of_bits + 63) / 64;
+
+	GoBitboard()
+	{
+		for (int w = 0; w < number_of_words; ++w) {
+			words[w] = 0;
+		}
+	}
+
+	static int bit(int i, int j)
+	{
+		return stride * i + j;
+	}
+
+	static GoBitboard single(int b)
+	{
+		GoBitboard result;
+		result.set(b);
+		return result;
+	}
+
+	// All points of the board.
+	static const GoBitboard& board()
+	{
+		struct Board
+		{
+			GoBitboard points;
+			Board()
+			{
+				for (int i = 0; i < M; ++i) {
+				for (int j = 0; j < N; ++j) {
+					points.set(bit(i, j));
+				}}
+			}
+		};
+		static const Board board;
+		return board.points;
+	}
+
+	bool get(int b) const
+	{
+		return (words[b >> 6] >> (b & 63)) & 1;
+	}
+
+	void set(int b)
+	{
+		words[b >> 6] |= std::uint64_t(1) << (b & 63);
+	}
+
+	void reset(int b)
+	{
+		words[b >> 6] &= ~(std::uint64_t(1) << (b & 63));
+	}
+
+	bool any() const
+	{
+		std::uint64_t result = 0;
+		for (int w = 0; w < number_of_words; ++w) {
+			result |= words[w];
+		}
+		return result != 0;
+	}
+
+	int count() const
+	{
+		int result = 0;
+		for (int w = 0; w < number_of_words; ++w) {
+			result += popcount(words[w]);
+		}
+		return result;
+	}
+
+	// The lowest bit that is set. The set must not be empty.
+	int first() const
+	{
+		for (int w = 0; w < number_of_words; ++w) {
+			if (words[w] != 0) {
+				return 64 * w + lowest_bit(words[w]);
+			}
+		}
+		attest(false);
+		return -1;
+	}
+
+	// The k:th lowest bit that is set, counting from zero.
+	int nth(int k) const
+	{
+		for (int w = 0; w < number_of_words; ++w) {
+			int bits = popcount(words[w]);
+			if (k < bits) {
+				auto word = words[w];
+				for (; k > 0; --k) {
+					word &= word - 1;
+				}
+				return 64 * w + lowest_bit(word);
+			}
+			k -= bits;
+		}
+		attest(false);
+		return -1;
+	}
+
+	GoBitboard operator | (const GoBitboard& other) const
+	{
+		GoBitboard result;
+		for (int w = 0; w < number_of_words; ++w) {
+			result.words[w] = words[w] | other.words[w];
+		}
+		return result;
+	}
+
+	GoBitboard operator & (const GoBitboard& other) const
+	{
+		GoBitboard result;
+		for (int w = 0; w < number_of_words; ++w) {
+			result.words[w] = words[w] & other.words[w];
+		}
+		return result;
+	}
+
+	// The points of this set that are not in other.
+	GoBitboard and_not(const GoBitboard& other) const
+	{
+		GoBitboard result;
+		for (int w = 0; w < number_of_words; ++w) {
+			result.words[w] = words[w] & ~other.words[w];
+		}
+		return result;
+	}
+
+	bool operator == (const GoBitboard& other) const
+	{
+		std::uint64_t difference = 0;
+		for (int w = 0; w < number_of_words; ++w) {
+			difference |= words[w] ^ other.words[w];
+		}
+		return difference == 0;
+	}
+
+	// The points of the board next to the points of this set.
+	GoBitboard neighbors() const
+	{
+		return (shift_up(1) | shift_down(1) | shift_up(stride) | shift_down(stride)) & board();
+	}
+
+	// The points of within connected to this set through points of
+	// within. This set should be a subset of within.
+	GoBitboard flood_fill(const GoBitboard& within) const
+	{
+		GoBitboard filled = *this;
+		while (true) {
+			auto next = (filled | filled.neighbors()) & within;
+			if (next == filled) {
+				return filled;
+			}
+			filled = next;
+		}
+	}
+
+private:
+	static int popcount(std::uint64_t x)
+	{
+		#ifdef __GNUC__
+		return __builtin_popcountll(x);
+		#else
+		int result = 0;
+		for (; x != 0; x &= x - 1) {
+			++result;
+		}
+		return result;
+		#endif
+	}
+
+	static int lowest_bit(std::uint64_t x)
+	{
+		#ifdef __GNUC__
+		return __builtin_ctzll(x);
+		#else
+		int result = 0;
+		while ((x & 1) == 0) {
+			x >>= 1;
+			++result;
+		}
+		return result;
+		#endif
+	}
+
+	// Moves every bit k positions up, for 0 < k < 64.
+	GoBitboard shift_up(int k) const
+	{
+		GoBitboard result;
+		result.words[0] = words[0] << k;
+		for (int w = 1; w < number_of_words; ++w) {
+			result.words[w] = (words[w] << k) | (words[w - 1] >> (64 - k));
+		}
+		return result;
+	}
+
+	// Moves every bit k positions down, for 0 < k < 64.
+	GoBitboard shift_down(int k) const
+	{
+		GoBitboard result;
+		for (int w = 0; w < number_of_words - 1; ++w) {
+			result.words[w] = (words[w] >> k) | (words[w + 1] << (64 - k));
+		}
+		result.words[number_of_words - 1] = words[number_of_words - 1] >> k;
+		return result;
+	}
+
+	std::uint64_t words[number_of_words];
+};
+
+//
+// Moves are numbered as in GoState, so that the two can be compared
+// move by move. The ko rule uses the same 64-bit position hash as
+// GoState, updated incrementally, and the same GoHashHistory of the
+// last 64 positions, so superko is only detected for cycles within
+// that many moves, exactly as in GoState.
+//
+template<unsigned int M, unsigned int N>
+class GoBitboardState
+{
+	typedef GoBitboard<M, N> Bitboard;
+
+public:
+	static const unsigned char empty = 0;
+	static const unsigned char player1 = 1;
+	static const unsigned char player2 = 2;
+	static const int rows = M;
+	static const int columns = N;
+	static const int max_depth = GoState<M, N>::max_depth;
+
+	int depth;
+	int player_to_move;
+	// As GoState::komi.
+	double komi;
+	typedef int Move;
+	static const Move no_move;
+	static const Move pass;
+
+	GoBitboardState() :
+		depth(0),
+		player_to_move(1),
+		komi(0),
+		hash(0)
+	{
+		// The empty board.
+		hash_history.insert(0);
+	}
+
+	GoBitboardState(char board[M][N+1]) :
+		depth(0),
+		player_to_move(1),
+		komi(0),
+		hash(0)
+	{
+		for (int i = 0; i < M; ++i) {
+		for (int j = 0; j < N; ++j) {
+			if (board[i][j] == '1' || board[i][j] == '2') {
+				int player = board[i][j] - '0';
+				stones[player - 1].set(Bitboard::bit(i, j));
+				hash ^= hash_key(Bitboard::bit(i, j), player);
+			}
+		}}
+	}
+
+	static int ij_to_ind(int i, int j)
+	{
+		attest(i >= 0 && j >= 0 && i < M && j < N);
+		return N*i + j;
+	}
+
+	static std::pair<int, int> ind_to_ij(int ind)
+	{
+		attest(ind >= 0 && ind < M * N);
+		return std::make_pair(ind / N, ind % N);
+	}
+
+	unsigned char get_pos(int i, int j) const
+	{
+		attest(ij_to_ind(i, j) >= 0);
+		auto b = Bitboard::bit(i, j);
+		return stones[0].get(b) ? 1 : stones[1].get(b) ? 2 : empty;
+	}
+
+	// Hash of the position for opening books, including the player to
+	// move but not the ko history.
+	std::uint64_t get_hash() const
+	{
+		auto result = MCTS::hash_bytes(stones, sizeof(stones));
+		return MCTS::hash_bytes(&player_to_move, sizeof(player_to_move), result);
+	}
+
+	bool is_move_possible(int i, int j) const
+	{
+		return is_move_possible(i, j, player_to_move);
+	}
+
+	bool is_move_possible(int i, int j, int player) const
+	{
+		if (i < 0 || i >= M || j < 0 || j >= N) {
+			return false;
+		}
+		auto b = Bitboard::bit(i, j);
+		if (stones[0].get(b) || stones[1].get(b)) {
+			return false;
+		}
+		return is_legal(b, player);
+	}
+
+	void do_move(Move move)
+	{
+		depth++;
+
+		const int player = player_to_move;
+		const int opponent = 3 - player;
+		player_to_move = opponent;
+		if (move == pass) {
+			return;
+		}
+
+		int i, j;
+		std::tie(i, j) = ind_to_ij(move);
+		attest(is_move_possible(i, j, player));
+
+		// As in GoState, the hashes are those before the captures.
+		auto b = Bitboard::bit(i, j);
+		stones[player - 1].set(b);
+		hash ^= hash_key(b, player);
+		hash_history.insert(hash);
+
+		// Remove opposing groups without liberties.
+		auto& opponent_stones = stones[opponent - 1];
+		auto empty_points = get_empty_points();
+		auto neighbors = Bitboard::single(b).neighbors() & opponent_stones;
+		while (neighbors.any()) {
+			auto group = Bitboard::single(neighbors.first()).flood_fill(opponent_stones);
+			if ( ! (group.neighbors() & empty_points).any()) {
+				opponent_stones = opponent_stones.and_not(group);
+				empty_points = empty_points | group;
+				for (auto captured = group; captured.any(); ) {
+					auto c = captured.first();
+					hash ^= hash_key(c, opponent);
+					captured.reset(c);
+				}
+			}
+			neighbors = neighbors.and_not(group);
+		}
+	}
+
+	template<typename RandomEngine>
+	void do_random_move(RandomEngine* engine)
+	{
+		// Draw points until a legal one is found. Every point is drawn at
+		// most once, so the move is uniformly distributed among the legal
+		// ones.
+		auto candidates = get_open_points(player_to_move);
+		for (int n = candidates.count(); n > 0; --n) {
+			std::uniform_int_distribution<int> point_ind(0, n - 1);
+			auto b = candidates.nth(point_ind(*engine));
+			if (is_legal(b, player_to_move)) {
+				do_move(ij_to_ind(b / Bitboard::stride, b % Bitboard::stride));
+				return;
+			}
+			candidates.reset(b);
+		}
+
+		// The player has to pass.
+		auto moves = get_moves();
+		attest(! moves.empty());
+		std::uniform_int_distribution<std::size_t> move_ind(0, moves.size() - 1);
+		do_move(moves[move_ind(*engine)]);
+	}
+
+	bool has_moves() const
+	{
+		if (depth >= max_depth) {
+			return false;
+		}
+		return has_legal_point(player_to_move) || has_legal_point(3 - player_to_move);
+	}
+
+	std::vector<Move> get_moves() const
+	{
+		std::vector<Move> moves;
+		if (depth >= max_depth) {
+			return moves;
+		}
+
+		for (auto candidates = get_open_points(player_to_move); candidates.any(); ) {
+			auto b = candidates.first();
+			if (is_legal(b, player_to_move)) {
+				moves.push_back(ij_to_ind(b / Bitboard::stride, b % Bitboard::stride));
+			}
+			candidates.reset(b);
+		}
+
+		if (moves.empty() && has_legal_point(3 - player_to_move)) {
+			moves.push_back(pass);
+		}
+		return moves;
+	}
+
+	// Area scoring as in GoState::get_scores.
+	void get_scores(int scores[3]) const
+	{
+		scores[0] = 0;
+		scores[1] = stones[0].count();
+		scores[2] = stones[1].count();
+
+		auto empty_points = get_empty_points();
+		for (auto remaining = empty_points; remaining.any(); ) {
+			auto region = Bitboard::single(remaining.first()).flood_fill(empty_points);
+			auto borders = region.neighbors();
+			bool borders1 = (borders & stones[0]).any();
+			bool borders2 = (borders & stones[1]).any();
+			if (borders1 && ! borders2) {
+				scores[1] += region.count();
+			}
+			else if (borders2 && ! borders1) {
+				scores[2] += region.count();
+			}
+			remaining = remaining.and_not(region);
+		}
+	}
+
+	int get_player_score(int player) const
+	{
+		int scores[3];
+		get_scores(scores);
+		return scores[player];
+	}
+
+	double get_result(int current_player_to_move) const
+	{
+		int scores[3];
+		get_scores(scores);
+		double score1 = scores[1];
+		double score2 = scores[2] + komi;
+		if (score1 == score2) {
+			return 0.5;
+		}
+		int winner = score1 > score2 ? 1 : 2;
+		return winner == current_player_to_move ? 0.0 : 1.0;
+	}
+
+private:
+	// The same hash as GoState::compute_hash_value.
+	static std::uint64_t hash_key(int b, int player)
+	{
+		return go_zobrist_key(N * (b / Bitboard::stride) + b % Bitboard::stride, player);
+	}
+
+	Bitboard get_empty_points() const
+	{
+		return Bitboard::board().and_not(stones[0] | stones[1]);
+	}
+
+	// The empty points that are not eyes of player, i.e. that have a
+	// neighbor that is not a stone of player. Only these may be legal.
+	Bitboard get_open_points(int player) const
+	{
+		auto not_own = Bitboard::board().and_not(stones[player - 1]);
+		return get_empty_points() & not_own.neighbors();
+	}
+
+	bool has_legal_point(int player) const
+	{
+		for (auto candidates = get_open_points(player); candidates.any(); ) {
+			auto b = candidates.first();
+			if (is_legal(b, player)) {
+				return true;
+			}
+			candidates.reset(b);
+		}
+		return false;
+	}
+
+	// Whether an empty point is a legal move for player.
+	bool is_legal(int b, int player) const
+	{
+		const auto& own = stones[player - 1];
+		const auto& opponent = stones[2 - player];
+		const auto point = Bitboard::single(b);
+
+		// Not possible to play in one's own eye.
+		if ( ! point.neighbors().and_not(own).any()) {
+			return false;
+		}
+
+		// The stone must have a liberty, possibly after capturing.
+		auto own_after = own | point;
+		auto empty_after = Bitboard::board().and_not(own_after | opponent);
+		bool possible = (point.flood_fill(own_after).neighbors() & empty_after).any();
+		auto neighbors = point.neighbors() & opponent;
+		while ( ! possible && neighbors.any()) {
+			auto group = Bitboard::single(neighbors.first()).flood_fill(opponent);
+			possible = ! (group.neighbors() & empty_after).any();
+			neighbors = neighbors.and_not(group);
+		}
+		if ( ! possible) {
+			return false;
+		}
+
+		// Ko rule.
+		return ! hash_history.contains(hash ^ hash_key(b, player));
+	}
+
+	// The stones of player 1 and 2.
+	Bitboard stones[2];
+	std::uint64_t hash;
+	GoHashHistory hash_history;
+};
+
+template<unsigned int M, unsigned int N>
+const unsigned char GoBitboardState<M, N>::empty;
+template<unsigned int M, unsigned int N>
+const unsigned char GoBitboardState<M, N>::player1;
+template<unsigned int M, unsigned int N>
+const int GoBitboardState<M, N>::max_depth;
+template<unsigned int M, unsigned int N>
+const unsigned char GoBitboardState<M, N>::player2;
+
+template<unsigned int M, unsigned int N>
+const typename GoBitboardState<M, N>::Move GoBitboardState<M, N>::no_move = -2;
+
+template<unsigned int M, unsigned int N>
+const typename GoBitboardState<M, N>::Move GoBitboardState<M, N>::pass = -1;
@@ -0,0 +1,616 @@
+// A Go engine speaking the Go Text Protocol (GTP) on standard input
+// and output, so that it can be played against other programs with
+// the usual match tools. Unlike go.cpp, it needs no graphics.
+//
+// The engine thinks for a fixed time per move unless the controller
+// sends time_settings, in which case the time is divided between the
+// remaining moves. The trees of the previous search are reused for the
+// next move, and with --ponder the engine keeps searching while the
+// opponent thinks.
+//
+// Note that GoState does not allow filling one's own eyes, so such
+// moves are rejected as illegal.
+//
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#include <mcts.h>
+
+#include "go.h"
+
+static const char* column_letters = "ABCDEFGHJKLMNOPQRSTUVWXYZ";
+
+struct EngineOptions
+{
+	MCTS::ComputeOptions search;
+	double seconds_per_move;
+	bool ponder;
+	// Pondering stops after this many iterations per thread, which bounds
+	// the memory used while the opponent thinks for a long time.
+	int ponder_iterations;
+};
+
+// The clocks of both players as told by time_settings and time_left.
+struct TimeControl
+{
+	TimeControl(double seconds_per_move_) :
+		seconds_per_move(seconds_per_move_),
+		main_time(-1),
+		byo_yomi_time(0),
+		byo_yomi_stones(0)
+	{
+		for (int player = 0; player < 3; ++player) {
+			time_left[player] = -1;
+			stones_left[player] = 0;
+		}
+	}
+
+	void set_time_settings(double main_time_, double byo_yomi_time_, int byo_yomi_stones_)
+	{
+		main_time = main_time_;
+		byo_yomi_time = byo_yomi_time_;
+		byo_yomi_stones = byo_yomi_stones_;
+		for (int player = 1; player <= 2; ++player) {
+			if (byo_yomi_time > 0 && byo_yomi_stones == 0) {
+				// No time limit.
+				time_left[player] = -1;
+				stones_left[player] = 0;
+			}
+			else if (main_time > 0) {
+				time_left[player] = main_time;
+				stones_left[player] = 0;
+			}
+			else {
+				time_left[player] = byo_yomi_time;
+				stones_left[player] = byo_yomi_stones;
+			}
+		}
+	}
+
+	void set_time_left(int player, double time, int stones)
+	{
+		time_left[player] = time;
+		stones_left[player] = stones;
+	}
+
+	void use_time(int player, double time)
+	{
+		if (time_left[player] >= 0) {
+			time_left[player] = max(0.0, time_left[player] - time);
+		}
+	}
+
+	// The thinking time for the next move of player. About half of the
+	// empty points are expected to be filled by the player.
+	double time_for_move(int player, int empty_points) const
+	{
+		if (time_left[player] < 0) {
+			return seconds_per_move;
+		}
+
+		// For communication and for stopping the threads.
+		const double margin = 0.5;
+		const double min_time = 0.05;
+		double available = time_left[player] - margin;
+		if (stones_left[player] > 0) {
+			// Byo-yomi: the time left is for stones_left stones.
+			return max(min_time, available / stones_left[player]);
+		}
+
+		double time = available / max(10.0, empty_points / 2.0);
+		if (byo_yomi_stones > 0) {
+			time += 0.5 * byo_yomi_time / byo_yomi_stones;
+		}
+		return max(min_time, min(time, available));
+	}
+
+	double seconds_per_move;
+	double main_time;
+	double byo_yomi_time;
+	int byo_yomi_stones;
+	double time_left[3];
+	int stones_left[3];
+};
+
+// The part of the engine that depends on the board size. Players are
+// 1 for black and 2 for white.
+class GoEngine
+{
+public:
+	virtual ~GoEngine()
+	{ }
+
+	virtual int size() const = 0;
+	virtual void clear_board() = 0;
+	// Komi is part of the state, so the search plays for a win under it.
+	virtual void set_komi(double komi) = 0;
+	// Returns false if the move is illegal.
+	virtual bool play(int player, const string& vertex) = 0;
+	virtual string genmove(int player, double seconds) = 0;
+	virtual bool undo() = 0;
+	virtual int number_of_empty_points() const = 0;
+	// The score of black minus the score of white, including komi.
+	virtual double score() const = 0;
+	virtual string showboard() const = 0;
+};
+
+template<int Size>
+class SizedGoEngine : public GoEngine
+{
+public:
+	typedef GoState<Size, Size> State;
+	typedef typename State::Move Move;
+
+	SizedGoEngine(const EngineOptions& options_) :
+		options(options_),
+		pondering(false),
+		can_reuse_trees(false)
+	{ }
+
+	int size() const
+	{
+		return Size;
+	}
+
+	void clear_board()
+	{
+		stop_pondering();
+		double komi = state.komi;
+		state = State();
+		state.komi = komi;
+		history.clear();
+		can_reuse_trees = false;
+	}
+
+	void set_komi(double komi)
+	{
+		stop_pondering();
+		state.komi = komi;
+		// The statistics of the trees are for the old komi.
+		can_reuse_trees = false;
+	}
+
+	bool play(int player, const string& vertex)
+	{
+		Move move;
+		if ( ! parse_vertex(vertex, &move)) {
+			return false;
+		}
+		if (move != State::pass) {
+			auto ij = State::ind_to_ij(move);
+			if ( ! state.is_move_possible(ij.first, ij.second, player)) {
+				return false;
+			}
+		}
+		stop_pondering();
+		do_move(player, move);
+		return true;
+	}
+
+	string genmove(int player, double seconds)
+	{
+		stop_pondering();
+		set_player_to_move(player);
+
+		Move move = State::pass;
+		if ( ! state.get_moves().empty()) {
+			auto search_options = options.search;
+			search_options.max_iterations = -1;
+			search_options.max_time = seconds;
+			start_search(search_options);
+			move = search.wait();
+		}
+		do_move(player, move);
+
+		if (options.ponder && state.has_moves()) {
+			auto ponder_options = options.search;
+			ponder_options.max_iterations = options.ponder_iterations;
+			ponder_options.max_time = -1;
+			ponder_options.verbose = false;
+			start_search(ponder_options);
+			pondering = true;
+		}
+		return vertex_to_string(move);
+	}
+
+	bool undo()
+	{
+		if (history.empty()) {
+			return false;
+		}
+		stop_pondering();
+		auto moves = history;
+		moves.pop_back();
+		clear_board();
+		for (auto& item: moves) {
+			do_move(item.first, item.second);
+		}
+		can_reuse_trees = false;
+		return true;
+	}
+
+	int number_of_empty_points() const
+	{
+		int count = 0;
+		for (int i = 0; i < Size; ++i) {
+		for (int j = 0; j < Size; ++j) {
+			count += state.get_pos(i, j) == State::empty;
+		}}
+		return count;
+	}
+
+	double score() const
+	{
+		int scores[3];
+		state.get_scores(scores);
+		return scores[1] - scores[2] - state.komi;
+	}
+
+	string showboard() const
+	{
+		stringstream sout;
+		sout << "\n   ";
+		for (int j = 0; j < Size; ++j) {
+			sout << " " << column_letters[j];
+		}
+		for (int i = 0; i < Size; ++i) {
+			sout << "\n" << setw(3) << Size - i;
+			for (int j = 0; j < Size; ++j) {
+				auto value = state.get_pos(i, j);
+				sout << " " << (value == 1 ? 'X' : value == 2 ? 'O' : '.');
+			}
+		}
+		return sout.str();
+	}
+
+private:
+	bool parse_vertex(string vertex, Move* move) const
+	{
+		transform(vertex.begin(), vertex.end(), vertex.begin(), ::toupper);
+		if (vertex == "PASS") {
+			*move = State::pass;
+			return true;
+		}
+		if (vertex.size() < 2) {
+			return false;
+		}
+		auto letter = string(column_letters).find(vertex[0]);
+		int row = atoi(vertex.c_str() + 1);
+		if (letter == string::npos || int(letter) >= Size || row < 1 || row > Size) {
+			return false;
+		}
+		*move = State::ij_to_ind(Size - row, int(letter));
+		return true;
+	}
+
+	static string vertex_to_string(Move move)
+	{
+		if (move == State::pass) {
+			return "pass";
+		}
+		auto ij = State::ind_to_ij(move);
+		stringstream sout;
+		sout << column_letters[ij.second] << Size - ij.first;
+		return sout.str();
+	}
+
+	// GTP allows several moves in a row by the same player. The trees
+	// assume alternating moves and cannot be reused then.
+	void set_player_to_move(int player)
+	{
+		if (state.player_to_move != player) {
+			state.player_to_move = player;
+			can_reuse_trees = false;
+		}
+	}
+
+	void do_move(int player, Move move)
+	{
+		set_player_to_move(player);
+		state.do_move(move);
+		history.push_back(make_pair(player, move));
+		moves_since_search.push_back(move);
+	}
+
+	void start_search(const MCTS::ComputeOptions& search_options)
+	{
+		if (can_reuse_trees) {
+			search.start_after_moves(moves_since_search, state, search_options);
+		}
+		else {
+			search.start(state, search_options);
+		}
+		can_reuse_trees = true;
+		moves_since_search.clear();
+	}
+
+	void stop_pondering()
+	{
+		if (pondering) {
+			search.stop();
+			search.wait();
+			pondering = false;
+		}
+	}
+
+	EngineOptions options;
+	State state;
+	vector<pair<int, Move>> history;
+	MCTS::SearchHandle<State> search;
+	bool pondering;
+	// Whether the trees of search lead to state via moves_since_search.
+	bool can_reuse_trees;
+	vector<Move> moves_since_search;
+};
+
+unique_ptr<GoEngine> create_engine(int size, const EngineOptions& options)
+{
+	switch (size) {
+		case 5:  return unique_ptr<GoEngine>(new SizedGoEngine<5>(options));
+		case 7:  return unique_ptr<GoEngine>(new SizedGoEngine<7>(options));
+		case 9:  return unique_ptr<GoEngine>(new SizedGoEngine<9>(options));
+		case 11: return unique_ptr<GoEngine>(new SizedGoEngine<11>(options));
+		case 13: return unique_ptr<GoEngine>(new SizedGoEngine<13>(options));
+		case 19: return unique_ptr<GoEngine>(new SizedGoEngine<19>(options));
+		default: return unique_ptr<GoEngine>();
+	}
+}
+
+bool parse_color(string color, int* player)
+{
+	transform(color.begin(), color.end(), color.begin(), ::tolower);
+	if (color == "b" || color == "black") {
+		*player = 1;
+		return true;
+	}
+	if (color == "w" || color == "white") {
+		*player = 2;
+		return true;
+	}
+	return false;
+}
+
+// Removes comments and control characters and turns tabs into spaces.
+string preprocess_line(const string& line)
+{
+	string result;
+	for (char c: line) {
+		if (c == '#') {
+			break;
+		}
+		if (c == '\t') {
+			result += ' ';
+		}
+		else if ( ! iscntrl(static_cast<unsigned char>(c))) {
+			result += c;
+		}
+	}
+	return result;
+}
+
+void run_gtp(EngineOptions options, int size)
+{
+	static const char* commands[] = {
+		"boardsize", "clear_board", "final_score", "genmove", "komi",
+		"known_command", "list_commands", "name", "play", "protocol_version",
+		"quit", "showboard", "time_left", "time_settings", "undo", "version"};
+
+	auto engine = create_engine(size, options);
+	TimeControl time_control(options.seconds_per_move);
+	double komi = 6.5;
+	engine->set_komi(komi);
+
+	string line;
+	while (getline(cin, line)) {
+		istringstream input(preprocess_line(line));
+		string id, command;
+		input >> command;
+		if (command.empty()) {
+			continue;
+		}
+		if (isdigit(static_cast<unsigned char>(command[0]))) {
+			id = command;
+			command.clear();
+			input >> command;
+		}
+
+		bool success = true;
+		string response;
+		if (command == "protocol_version") {
+			response = "2";
+		}
+		else if (command == "name") {
+			response = "MCTS";
+		}
+		else if (command == "version") {
+			response = "1.0";
+		}
+		else if (command == "known_command") {
+			string name;
+			input >> name;
+			response = find(begin(commands), end(commands), name) != end(commands) ? "true" : "false";
+		}
+		else if (command == "list_commands") {
+			for (auto name: commands) {
+				response += string(response.empty() ? "" : "\n") + name;
+			}
+		}
+		else if (command == "quit") {
+			cout << "=" << id << "\n\n" << flush;
+			break;
+		}
+		else if (command == "boardsize") {
+			int new_size = 0;
+			input >> new_size;
+			auto new_engine = create_engine(new_size, options);
+			if (new_engine) {
+				engine = move(new_engine);
+				engine->set_komi(komi);
+			}
+			else {
+				success = false;
+				response = "unacceptable size";
+			}
+		}
+		else if (command == "clear_board") {
+			engine->clear_board();
+		}
+		else if (command == "komi") {
+			double new_komi = 0;
+			success = bool(input >> new_komi);
+			if (success) {
+				komi = new_komi;
+				engine->set_komi(komi);
+			}
+			else {
+				response = "syntax error";
+			}
+		}
+		else if (command == "play") {
+			string color, vertex;
+			int player;
+			input >> color >> vertex;
+			if ( ! parse_color(color, &player) || vertex.empty()) {
+				success = false;
+				response = "syntax error";
+			}
+			else if ( ! engine->play(player, vertex)) {
+				success = false;
+				response = "illegal move";
+			}
+		}
+		else if (command == "genmove") {
+			string color;
+			int player;
+			input >> color;
+			if ( ! parse_color(color, &player)) {
+				success = false;
+				response = "syntax error";
+			}
+			else {
+				auto start_time = chrono::steady_clock::now();
+				double seconds = time_control.time_for_move(player, engine->number_of_empty_points());
+				response = engine->genmove(player, seconds);
+				time_control.use_time(player,
+					chrono::duration<double>(chrono::steady_clock::now() - start_time).count());
+			}
+		}
+		else if (command == "undo") {
+			if ( ! engine->undo()) {
+				success = false;
+				response = "cannot undo";
+			}
+		}
+		else if (command == "time_settings") {
+			double main_time = 0, byo_yomi_time = 0;
+			int byo_yomi_stones = 0;
+			if (input >> main_time >> byo_yomi_time >> byo_yomi_stones) {
+				time_control.set_time_settings(main_time, byo_yomi_time, byo_yomi_stones);
+			}
+			else {
+				success = false;
+				response = "syntax error";
+			}
+		}
+		else if (command == "time_left") {
+			string color;
+			double time = 0;
+			int stones = 0;
+			int player;
+			if (input >> color >> time >> stones && parse_color(color, &player)) {
+				time_control.set_time_left(player, time, stones);
+			}
+			else {
+				success = false;
+				response = "syntax error";
+			}
+		}
+		else if (command == "showboard") {
+			response = engine->showboard();
+		}
+		else if (command == "final_score") {
+			double score = engine->score();
+			stringstream sout;
+			if (score > 0) {
+				sout << "B+" << score;
+			}
+			else if (score < 0) {
+				sout << "W+" << -score;
+			}
+			else {
+				sout << "0";
+			}
+			response = sout.str();
+		}
+		else {
+			success = false;
+			response = "unknown command";
+		}
+
+		cout << (success ? "=" : "?") << id << " " << response << "\n\n" << flush;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	EngineOptions options;
+	options.seconds_per_move = 5.0;
+	options.ponder = false;
+	options.ponder_iterations = 1000000;
+	options.search.number_of_threads = int(thread::hardware_concurrency());
+	if (options.search.number_of_threads <= 0) {
+		options.search.number_of_threads = 8;
+	}
+	int size = 9;
+
+	for (int i = 1; i < argc; ++i) {
+		string arg = argv[i];
+		if (arg == "--size" && i + 1 < argc) {
+			size = atoi(argv[++i]);
+		}
+		else if (arg == "--time" && i + 1 < argc) {
+			options.seconds_per_move = atof(argv[++i]);
+		}
+		else if (arg == "--threads" && i + 1 < argc) {
+			options.search.number_of_threads = atoi(argv[++i]);
+		}
+		else if (arg == "--ponder") {
+			options.ponder = true;
+		}
+		else if (arg == "--verbose") {
+			options.search.verbose = true;
+		}
+		else {
+			cerr << "Usage: " << argv[0] << " [--size n] [--time seconds] [--threads n] [--ponder] [--verbose]" << endl
+			     << "  --size:    board size: 5, 7, 9 (default), 11, 13 or 19." << endl
+			     << "  --time:    seconds per move without time_settings (default 5)." << endl
+			     << "  --threads: default is the number of cores." << endl
+			     << "  --ponder:  search while the opponent thinks." << endl
+			     << "  --verbose: print search statistics to stderr." << endl;
+			return 1;
+		}
+	}
+	if ( ! create_engine(size, options)) {
+		cerr << "Unsupported board size: " << size << endl;
+		return 1;
+	}
+
+	try {
+		run_gtp(options, size);
+	}
+	catch (std::runtime_error& error) {
+		std::cerr << "ERROR: " << error.what() << std::endl;
+		return 1;
+	}
+}
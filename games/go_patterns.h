@@ -0,0 +1,448 @@
+// Petter Strandmark 2013
+// petter.strandmark@gmail.com
+
+#include <random>
+#include <vector>
+
+#include <mcts.h>
+
+//
+// The 3x3 neighborhood of a point is encoded as a 16-bit key with two
+// bits per neighbor: 0 for empty, 1 and 2 for the players and 3 for
+// outside the board. The neighbors are stored row by row, skipping the
+// point itself:
+//
+//     0 1 2
+//     3 . 4
+//     5 6 7
+//
+// Neighbor k is stored at bits 2k and 2k + 1.
+//
+static const int go_pattern_slot_N = 1;
+static const int go_pattern_slot_W = 3;
+static const int go_pattern_slot_E = 4;
+static const int go_pattern_slot_S = 6;
+
+inline int go_pattern_neighbor(unsigned short key, int slot)
+{
+	return (key >> (2 * slot)) & 3;
+}
+
+// The weight of playing in the middle of a pattern in rollouts.
+inline unsigned short go_pattern_weight(unsigned short key, int player)
+{
+	const int own = player;
+	const int opponent = 3 - player;
+	const int edge = 3;
+
+	const int orthogonal[4] = {go_pattern_slot_N, go_pattern_slot_W, go_pattern_slot_E, go_pattern_slot_S};
+	int counts[4] = {0, 0, 0, 0};
+	for (int slot: orthogonal) {
+		counts[go_pattern_neighbor(key, slot)]++;
+	}
+
+	if (counts[own] + counts[edge] == 4) {
+		// Filling one's own eye.
+		return 0;
+	}
+	if (counts[opponent] + counts[edge] == 4) {
+		// Only legal if it captures.
+		return 60;
+	}
+
+	int weight = 10;
+	if (counts[own] > 0 && counts[opponent] > 0) {
+		// Contact fight.
+		weight += 20;
+	}
+
+	// Two orthogonal neighbors and the diagonal point between them.
+	const int corners[4][3] = {{go_pattern_slot_N, go_pattern_slot_W, 0},
+	                           {go_pattern_slot_N, go_pattern_slot_E, 2},
+	                           {go_pattern_slot_S, go_pattern_slot_W, 5},
+	                           {go_pattern_slot_S, go_pattern_slot_E, 7}};
+	bool bad_shape = false;
+	for (auto& corner: corners) {
+		int a = go_pattern_neighbor(key, corner[0]);
+		int b = go_pattern_neighbor(key, corner[1]);
+		int diagonal = go_pattern_neighbor(key, corner[2]);
+		if (a == opponent && b == opponent && diagonal != opponent) {
+			// Cut.
+			weight += 40;
+		}
+		else if (a == own && b == own) {
+			if (diagonal == opponent) {
+				// Connect against a cut.
+				weight += 40;
+			}
+			else {
+				// Empty triangle or a solid 2x2 block.
+				bad_shape = true;
+			}
+		}
+	}
+	if (bad_shape && weight == 10) {
+		weight = 3;
+	}
+
+	bool has_stones = false;
+	for (int slot = 0; slot < 8; ++slot) {
+		int value = go_pattern_neighbor(key, slot);
+		has_stones = has_stones || value == 1 || value == 2;
+	}
+	if (counts[edge] > 0 && ! has_stones) {
+		// First line in an empty area.
+		return 2;
+	}
+	return weight;
+}
+
+// Weights of all keys for player 1 followed by all keys for player 2.
+inline const std::vector<unsigned short>& go_pattern_table()
+{
+	struct Table
+	{
+		std::vector<unsigned short> weights;
+		Table()
+		{
+			weights.resize(2 << 16);
+			for (int player = 1; player <= 2; ++player) {
+				for (int key = 0; key < (1 << 16); ++key) {
+					weights[((player - 1) << 16) + key] = go_pattern_weight(key, player);
+				}
+			}
+		}
+	};
+	static const Table table;
+	return table.weights;
+}
+
+//
+// Go with a rollout policy based on 3x3 patterns. The keys of all points
+// are updated incrementally as stones are placed and removed. The rollout
+// weight of every empty point is kept in a Fenwick tree per player, so
+// updating a weight and sampling a point both take O(log(M*N)).
+//
+// A random move is, in order of priority:
+//  1. capturing the group of the last move if it is in atari,
+//  2. saving a group next to the last move that is in atari,
+//  3. a good shape next to the last move, and
+//  4. any point, sampled by its pattern weight.
+// Capturing and saving need the liberties of groups, which are not part
+// of the 3x3 neighborhood, and are therefore checked directly.
+//
+// Include go.h before this file.
+//
+template<unsigned int M, unsigned int N>
+class GoPatternState:
+	public GoStateBase<GoPatternState<M, N>, M, N>
+{
+	typedef GoStateBase<GoPatternState<M, N>, M, N> Base;
+	friend Base;
+
+public:
+	typedef typename Base::Move Move;
+
+	GoPatternState()
+	{
+		initialize_patterns();
+	}
+
+	GoPatternState(char board[M][N+1])
+	{
+		initialize_patterns();
+		for (int i = 0; i < M; ++i) {
+		for (int j = 0; j < N; ++j) {
+			if (board[i][j] == '1') {
+				this->set_pos(i, j, 1);
+			}
+			else if (board[i][j] == '2') {
+				this->set_pos(i, j, 2);
+			}
+		}}
+	}
+
+	void do_move(Move move)
+	{
+		last_move = move;
+		Base::do_move(move);
+	}
+
+	template<typename RandomEngine>
+	void do_random_move(RandomEngine* engine)
+	{
+		auto move = local_move(engine);
+		if (move == Base::no_move) {
+			move = weighted_move(engine);
+		}
+		if (move == Base::no_move) {
+			// No point is legal, so the player has to pass.
+			auto moves = this->get_moves();
+			attest(! moves.empty());
+			std::uniform_int_distribution<std::size_t> move_ind(0, moves.size() - 1);
+			move = moves[move_ind(*engine)];
+		}
+		do_move(move);
+	}
+
+	unsigned short get_pattern_key(int i, int j) const
+	{
+		return keys[Base::ij_to_ind(i, j)];
+	}
+
+	// The current rollout weight of a point for a player.
+	int get_weight(int i, int j, int player) const
+	{
+		return point_weight[player - 1][Base::ij_to_ind(i, j)];
+	}
+
+	int get_total_weight(int player) const
+	{
+		return total_weight[player - 1];
+	}
+
+	// Computes the key of a point from the board.
+	unsigned short compute_pattern_key(int i, int j) const
+	{
+		unsigned short key = 0;
+		for (int slot = 0; slot < 8; ++slot) {
+			int ni = i + offsets(slot)[0];
+			int nj = j + offsets(slot)[1];
+			int value = 3;
+			if (0 <= ni && ni < M && 0 <= nj && nj < N) {
+				value = this->board[ni][nj];
+			}
+			key |= value << (2 * slot);
+		}
+		return key;
+	}
+
+	// Counts the liberties of the group at (i, j), stopping at
+	// max_liberties. The last liberty found is stored in liberty.
+	int count_liberties(int i, int j, int max_liberties, int* liberty) const
+	{
+		const int player = this->board[i][j];
+		attest(player != Base::empty);
+
+		bool seen[M * N] = {};
+		int stack[M * N];
+		int stack_size = 0;
+		int liberties = 0;
+		stack[stack_size++] = N*i + j;
+		seen[N*i + j] = true;
+		while (stack_size > 0) {
+			int p = stack[--stack_size];
+			for (int slot: {go_pattern_slot_N, go_pattern_slot_W, go_pattern_slot_E, go_pattern_slot_S}) {
+				int ni = p / N + offsets(slot)[0];
+				int nj = p % N + offsets(slot)[1];
+				if (ni < 0 || ni >= M || nj < 0 || nj >= N || seen[N*ni + nj]) {
+					continue;
+				}
+				if (this->board[ni][nj] == Base::empty) {
+					seen[N*ni + nj] = true;
+					*liberty = N*ni + nj;
+					if (++liberties >= max_liberties) {
+						return liberties;
+					}
+				}
+				else if (this->board[ni][nj] == player) {
+					seen[N*ni + nj] = true;
+					stack[stack_size++] = N*ni + nj;
+				}
+			}
+		}
+		return liberties;
+	}
+
+protected:
+	void point_changed(int i, int j)
+	{
+		const int value = this->board[i][j];
+		for (int slot = 0; slot < 8; ++slot) {
+			int ni = i + offsets(slot)[0];
+			int nj = j + offsets(slot)[1];
+			if (0 <= ni && ni < M && 0 <= nj && nj < N) {
+				// (i, j) is at the opposite slot as seen from the neighbor.
+				int q = N*ni + nj;
+				int shift = 2 * (7 - slot);
+				keys[q] = (keys[q] & ~(3 << shift)) | (value << shift);
+				update_weights(q);
+			}
+		}
+		update_weights(N*i + j);
+	}
+
+private:
+	static const int* offsets(int slot)
+	{
+		static const int offsets[8][2] = {{-1, -1}, {-1, 0}, {-1, 1},
+		                                  { 0, -1},          { 0, 1},
+		                                  { 1, -1}, { 1, 0}, { 1, 1}};
+		return offsets[slot];
+	}
+
+	void initialize_patterns()
+	{
+		last_move = Base::no_move;
+		for (int player = 0; player < 2; ++player) {
+			total_weight[player] = 0;
+			for (int p = 0; p <= M * N; ++p) {
+				weight_tree[player][p] = 0;
+			}
+			for (int p = 0; p < M * N; ++p) {
+				point_weight[player][p] = 0;
+			}
+		}
+		for (int i = 0; i < M; ++i) {
+		for (int j = 0; j < N; ++j) {
+			keys[N*i + j] = compute_pattern_key(i, j);
+			update_weights(N*i + j);
+		}}
+	}
+
+	void set_weight(int player, int p, int weight)
+	{
+		int delta = weight - point_weight[player - 1][p];
+		if (delta == 0) {
+			return;
+		}
+		point_weight[player - 1][p] = weight;
+		total_weight[player - 1] += delta;
+		for (int k = p + 1; k <= M * N; k += k & -k) {
+			weight_tree[player - 1][k] += delta;
+		}
+	}
+
+	void update_weights(int p)
+	{
+		auto& table = go_pattern_table();
+		bool is_empty = this->board[p / N][p % N] == Base::empty;
+		set_weight(1, p, is_empty ? table[keys[p]] : 0);
+		set_weight(2, p, is_empty ? table[(1 << 16) + keys[p]] : 0);
+	}
+
+	// The point p such that the weights of all points before it sum to at
+	// most r and the weights up to and including it sum to more than r.
+	int find_point(int player, int r) const
+	{
+		int step = 1;
+		while (2 * step <= M * N) {
+			step *= 2;
+		}
+		int p = 0;
+		for (; step > 0; step /= 2) {
+			if (p + step <= M * N && weight_tree[player - 1][p + step] <= r) {
+				p += step;
+				r -= weight_tree[player - 1][p];
+			}
+		}
+		return p;
+	}
+
+	int number_of_empty_neighbors(int p) const
+	{
+		int count = 0;
+		for (int slot: {go_pattern_slot_N, go_pattern_slot_W, go_pattern_slot_E, go_pattern_slot_S}) {
+			count += go_pattern_neighbor(keys[p], slot) == Base::empty;
+		}
+		return count;
+	}
+
+	template<typename RandomEngine>
+	Move local_move(RandomEngine* engine) const
+	{
+		if (last_move < 0) {
+			return Base::no_move;
+		}
+		const int player = this->player_to_move;
+		const int i = last_move / N;
+		const int j = last_move % N;
+		int liberty = -1;
+
+		if (this->board[i][j] == 3 - player &&
+		    count_liberties(i, j, 2, &liberty) == 1) {
+			attest(liberty >= 0);
+			if (this->is_move_possible(liberty / N, liberty % N, player)) {
+				return liberty;
+			}
+		}
+
+		for (int slot: {go_pattern_slot_N, go_pattern_slot_W, go_pattern_slot_E, go_pattern_slot_S}) {
+			int ni = i + offsets(slot)[0];
+			int nj = j + offsets(slot)[1];
+			if (0 <= ni && ni < M && 0 <= nj && nj < N &&
+			    this->board[ni][nj] == player &&
+			    count_liberties(ni, nj, 2, &liberty) == 1) {
+				attest(liberty >= 0);
+				if (number_of_empty_neighbors(liberty) >= 2 &&
+				    this->is_move_possible(liberty / N, liberty % N, player)) {
+					return liberty;
+				}
+			}
+		}
+
+		// Points around the last move whose pattern is better than an
+		// empty neighborhood.
+		int candidates[8];
+		int weights[8];
+		int number_of_candidates = 0;
+		int sum = 0;
+		for (int slot = 0; slot < 8; ++slot) {
+			int ni = i + offsets(slot)[0];
+			int nj = j + offsets(slot)[1];
+			if (0 <= ni && ni < M && 0 <= nj && nj < N) {
+				int weight = point_weight[player - 1][N*ni + nj];
+				if (weight > go_pattern_weight(0, player)) {
+					candidates[number_of_candidates] = N*ni + nj;
+					weights[number_of_candidates++] = weight;
+					sum += weight;
+				}
+			}
+		}
+		if (sum > 0) {
+			std::uniform_int_distribution<int> weight_dist(0, sum - 1);
+			int r = weight_dist(*engine);
+			int k = 0;
+			while (r >= weights[k]) {
+				r -= weights[k++];
+			}
+			if (this->is_move_possible(candidates[k] / N, candidates[k] % N, player)) {
+				return candidates[k];
+			}
+		}
+		return Base::no_move;
+	}
+
+	// Samples points by weight until a legal one is found. Rejected points
+	// get weight zero until the move has been chosen, so every point is
+	// tried at most once.
+	template<typename RandomEngine>
+	Move weighted_move(RandomEngine* engine)
+	{
+		const int player = this->player_to_move;
+		int rejected[M * N];
+		int number_of_rejected = 0;
+		Move move = Base::no_move;
+		while (total_weight[player - 1] > 0) {
+			std::uniform_int_distribution<int> weight_dist(0, total_weight[player - 1] - 1);
+			int p = find_point(player, weight_dist(*engine));
+			if (this->is_move_possible(p / N, p % N, player)) {
+				move = p;
+				break;
+			}
+			rejected[number_of_rejected++] = p;
+			set_weight(player, p, 0);
+		}
+		for (int k = 0; k < number_of_rejected; ++k) {
+			update_weights(rejected[k]);
+		}
+		return move;
+	}
+
+	Move last_move;
+	unsigned short keys[M * N];
+	// Fenwick trees (1-based) of the weights of each player.
+	int weight_tree[2][M * N + 1];
+	unsigned short point_weight[2][M * N];
+	int total_weight[2];
+};
@@ -0,0 +1,316 @@
+// Reading and writing Go game records in the Smart Game Format (SGF).
+//
+// Only what is needed to replay a game is kept: the board size, komi,
+// result, setup stones and the moves of the main line. Other properties
+// and variations are skipped. Games are read one at a time from a
+// stream, so a file or pipe with many games never has to be in memory
+// at once.
+//
+// replay_sgf_game plays the moves in a GoState (or a state with the
+// same interface), so the ko history is the same as in the game.
+//
+// Include go.h before this file.
+//
+
+#include <cctype>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <mcts.h>
+
+// A move or a setup stone. Rows are counted from the top, as in GoState.
+struct SgfMove
+{
+	int player;
+	int i;  // -1 for a pass.
+	int j;
+};
+
+struct SgfGame
+{
+	SgfGame() :
+		size(19),
+		komi(0),
+		first_player(0)
+	{ }
+
+	int size;
+	double komi;
+	std::string result;
+	// The player to move first if given by PL, otherwise 0.
+	int first_player;
+	std::vector<SgfMove> setup;
+	std::vector<SgfMove> moves;
+};
+
+namespace sgf
+{
+inline std::runtime_error error(const std::string& message)
+{
+	return std::runtime_error("SGF: " + message);
+}
+
+inline int next_char(std::istream& in)
+{
+	while (std::isspace(in.peek())) {
+		in.get();
+	}
+	return in.peek();
+}
+
+inline void expect(std::istream& in, char c)
+{
+	if (next_char(in) != c) {
+		throw error(std::string("expected '") + c + "'.");
+	}
+	in.get();
+}
+
+inline std::string read_value(std::istream& in)
+{
+	expect(in, '[');
+	std::string value;
+	while (true) {
+		int c = in.get();
+		if (c == EOF) {
+			throw error("unterminated value.");
+		}
+		if (c == ']') {
+			return value;
+		}
+		if (c == '\\') {
+			c = in.get();
+			if (c == EOF) {
+				throw error("unterminated value.");
+			}
+		}
+		value += char(c);
+	}
+}
+
+inline SgfMove parse_point(const std::string& value, int player, int size)
+{
+	SgfMove move = {player, -1, -1};
+	if (value.empty() || (value == "tt" && size <= 19)) {
+		return move;
+	}
+	if (value.size() != 2 || ! std::islower(value[0]) || ! std::islower(value[1])) {
+		throw error("invalid point [" + value + "].");
+	}
+	move.j = value[0] - 'a';
+	move.i = value[1] - 'a';
+	if (move.i >= size || move.j >= size) {
+		throw error("point [" + value + "] outside the board.");
+	}
+	return move;
+}
+
+inline void apply_property(const std::string& name, const std::vector<std::string>& values, SgfGame* game)
+{
+	if (name == "SZ") {
+		auto& value = values.at(0);
+		auto colon = value.find(':');
+		if (colon != std::string::npos && value.substr(0, colon) != value.substr(colon + 1)) {
+			throw error("only square boards are supported.");
+		}
+		game->size = std::atoi(value.c_str());
+		if (game->size <= 0 || game->size > 25) {
+			throw error("invalid board size [" + value + "].");
+		}
+	}
+	else if (name == "KM") {
+		game->komi = std::atof(values.at(0).c_str());
+	}
+	else if (name == "RE") {
+		game->result = values.at(0);
+	}
+	else if (name == "PL") {
+		game->first_player = values.at(0) == "W" || values.at(0) == "w" ? 2 : 1;
+	}
+	else if (name == "AB" || name == "AW") {
+		if ( ! game->moves.empty()) {
+			throw error("setup stones after the first move are not supported.");
+		}
+		for (auto& value: values) {
+			game->setup.push_back(parse_point(value, name == "AB" ? 1 : 2, game->size));
+			if (game->setup.back().i < 0) {
+				throw error("invalid setup point [" + value + "].");
+			}
+		}
+	}
+	else if (name == "B" || name == "W") {
+		game->moves.push_back(parse_point(values.at(0), name == "B" ? 1 : 2, game->size));
+	}
+}
+
+// Reads a game tree after its '('. Only the first variation is part of
+// the main line.
+inline void read_game_tree(std::istream& in, bool main_line, SgfGame* game)
+{
+	if (next_char(in) != ';') {
+		throw error("expected a node.");
+	}
+	while (next_char(in) == ';') {
+		in.get();
+		while (std::isalpha(next_char(in))) {
+			// Lower case letters were allowed in identifiers in old
+			// versions of the format and are ignored.
+			std::string name;
+			while (std::isalpha(in.peek())) {
+				char c = char(in.get());
+				if (std::isupper(c)) {
+					name += c;
+				}
+			}
+			std::vector<std::string> values;
+			while (next_char(in) == '[') {
+				values.push_back(read_value(in));
+			}
+			if (values.empty()) {
+				throw error("property " + name + " without a value.");
+			}
+			if (main_line) {
+				apply_property(name, values, game);
+			}
+		}
+	}
+
+	bool first_variation = true;
+	while (next_char(in) == '(') {
+		in.get();
+		read_game_tree(in, main_line && first_variation, game);
+		first_variation = false;
+	}
+	expect(in, ')');
+}
+}
+
+// Reads the next game of a stream. Returns false if there are no more
+// games and throws std::runtime_error if the game is malformed.
+inline bool read_sgf_game(std::istream& in, SgfGame* game)
+{
+	*game = SgfGame();
+	int c = sgf::next_char(in);
+	if (c == EOF) {
+		return false;
+	}
+	sgf::expect(in, '(');
+	sgf::read_game_tree(in, true, game);
+	return true;
+}
+
+inline void write_sgf_point(std::ostream& out, const SgfMove& move)
+{
+	out << "[";
+	if (move.i >= 0) {
+		out << char('a' + move.j) << char('a' + move.i);
+	}
+	out << "]";
+}
+
+inline void write_sgf_game(std::ostream& out, const SgfGame& game)
+{
+	out << "(;GM[1]FF[4]SZ[" << game.size << "]KM[" << game.komi << "]";
+	if ( ! game.result.empty()) {
+		out << "RE[";
+		for (char c: game.result) {
+			if (c == ']' || c == '\\') {
+				out << '\\';
+			}
+			out << c;
+		}
+		out << "]";
+	}
+	for (int player = 1; player <= 2; ++player) {
+		bool first = true;
+		for (auto& stone: game.setup) {
+			if (stone.player == player) {
+				out << (first ? (player == 1 ? "AB" : "AW") : "");
+				write_sgf_point(out, stone);
+				first = false;
+			}
+		}
+	}
+	if (game.first_player != 0) {
+		out << "PL[" << (game.first_player == 1 ? "B" : "W") << "]";
+	}
+	out << "\n";
+	for (auto& move: game.moves) {
+		out << ";" << (move.player == 1 ? "B" : "W");
+		write_sgf_point(out, move);
+	}
+	out << ")\n";
+}
+
+// A game record with the stones of state as setup stones, so that the
+// position can be loaded again. The ko history is not included.
+template<typename State>
+SgfGame sgf_game_from_position(const State& state)
+{
+	attest(State::rows == State::columns);
+	SgfGame game;
+	game.size = State::rows;
+	for (int i = 0; i < State::rows; ++i) {
+	for (int j = 0; j < State::columns; ++j) {
+		if (state.get_pos(i, j) != State::empty) {
+			SgfMove stone = {state.get_pos(i, j), i, j};
+			game.setup.push_back(stone);
+		}
+	}}
+	game.first_player = state.player_to_move;
+	game.komi = state.komi;
+	return game;
+}
+
+// Plays the game and returns the position before every move followed by
+// the final position, all with the komi of the game. Throws
+// std::runtime_error if the board size does not match the state or a
+// move is not legal in State. Note that GoState does not allow filling
+// one's own eyes.
+template<typename State>
+std::vector<State> replay_sgf_game(const SgfGame& game)
+{
+	if (game.size != State::rows || game.size != State::columns) {
+		throw sgf::error("the board size does not match.");
+	}
+
+	State state;
+	if ( ! game.setup.empty()) {
+		char board[State::rows][State::columns + 1];
+		for (int i = 0; i < State::rows; ++i) {
+			for (int j = 0; j < State::columns; ++j) {
+				board[i][j] = '.';
+			}
+			board[i][State::columns] = '\0';
+		}
+		for (auto& stone: game.setup) {
+			board[stone.i][stone.j] = char('0' + stone.player);
+		}
+		state = State(board);
+	}
+	state.komi = game.komi;
+	if (game.first_player != 0) {
+		state.player_to_move = game.first_player;
+	}
+
+	std::vector<State> positions;
+	for (auto& move: game.moves) {
+		// Records may have several moves in a row by the same player.
+		state.player_to_move = move.player;
+		positions.push_back(state);
+		if (move.i < 0) {
+			state.do_move(State::pass);
+		}
+		else if (state.is_move_possible(move.i, move.j)) {
+			state.do_move(State::ij_to_ind(move.i, move.j));
+		}
+		else {
+			throw sgf::error("illegal move " + std::to_string(positions.size()) + ".");
+		}
+	}
+	positions.push_back(state);
+	return positions;
+}
@@ -9,10 +9,11 @@
 using namespace std;
 
 #include <mcts.h>
+#include <mcts_book.h>
 
 #include "kalaha.h"
 
-void main_program()
+void main_program(const char* book_file)
 {
 	using namespace std;
 
@@ -30,6 +31,18 @@ void main_program()
 	typedef KalahaState<6> State;
 	State state(3);
 
+	std::unique_ptr<MCTS::PositionBook<State::Move>> book;
+	if (book_file != nullptr) {
+		book.reset(new MCTS::PositionBook<State::Move>(book_file));
+	}
+	auto compute_move = [&book](const State& state, const MCTS::ComputeOptions& options)
+	{
+		if (book) {
+			return MCTS::compute_move_with_book(state, *book, options);
+		}
+		return MCTS::compute_move(state, options);
+	};
+
 	stringstream move_string;
 
 	while (state.has_moves()) {
@@ -38,7 +51,7 @@ void main_program()
 
 		State::Move move = State::no_move;
 		if (state.player_to_move == 1) {
-			move = MCTS::compute_move(state, player1_options);
+			move = compute_move(state, player1_options);
 			state.do_move(move);
 		}
 		else {
@@ -57,7 +70,7 @@ void main_program()
 				}
 			}
 			else {
-				move = MCTS::compute_move(state, player2_options);
+				move = compute_move(state, player2_options);
 				state.do_move(move);
 			}
 		}
@@ -91,10 +104,11 @@ void main_program()
 	cout << move_string.str() << endl;
 }
 
-int main()
+int main(int argc, char* argv[])
 {
 	try {
-		main_program();
+		// An optional position book built with opening_book.
+		main_program(argc > 1 ? argv[1] : nullptr);
 	}
 	catch (std::runtime_error& error) {
 		std::cerr << "ERROR: " << error.what() << std::endl;
@@ -143,6 +143,16 @@ public:
 		return moves;
 	}
 
+	std::uint64_t get_hash() const
+	{
+		auto hash = MCTS::hash_bytes(player1_bins, sizeof(player1_bins));
+		hash = MCTS::hash_bytes(player2_bins, sizeof(player2_bins), hash);
+		hash = MCTS::hash_bytes(&player1_store, sizeof(player1_store), hash);
+		hash = MCTS::hash_bytes(&player2_store, sizeof(player2_store), hash);
+		hash = MCTS::hash_bytes(&player_to_move, sizeof(player_to_move), hash);
+		return MCTS::hash_bytes(&player_must_pass, sizeof(player_must_pass), hash);
+	}
+
 	double get_result(int current_player_to_move) const
 	{
 		short player1_sum = player1_store;
@@ -59,6 +59,12 @@ public:
 		return moves;
 	}
 
+	std::uint64_t get_hash() const
+	{
+		auto hash = MCTS::hash_bytes(&chips, sizeof(chips));
+		return MCTS::hash_bytes(&player_to_move, sizeof(player_to_move), hash);
+	}
+
 	double get_result(int current_player_to_move) const
 	{
 		attest(chips == 0);
@@ -0,0 +1,166 @@
+// Builds position books for the games.
+//
+// Starting from the initial position, every position is searched with
+// compute_root_statistics and the most visited moves are followed until
+// the given number of plies. The results are written as a PositionBook
+// (see mcts_book.h) that the games use instead of searching.
+//
+// Searched positions are appended to <book file>.journal as they are
+// finished. If the program is interrupted, running it again with the
+// same arguments continues where it stopped.
+//
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#include <mcts.h>
+#include <mcts_book.h>
+
+#include "connect_four.h"
+#include "go.h"
+#include "kalaha.h"
+#include "nim.h"
+
+struct BookOptions
+{
+	int plies;
+	int width;
+	MCTS::ComputeOptions search;
+};
+
+// Plays moves as long as there is only one to choose from.
+template<typename State>
+void play_forced_moves(State* state)
+{
+	while (state->has_moves()) {
+		auto moves = state->get_moves();
+		if (moves.size() != 1) {
+			break;
+		}
+		state->do_move(moves[0]);
+	}
+}
+
+template<typename State>
+void build_book(State start_state, const string& book_file, const BookOptions& options)
+{
+	typedef typename State::Move Move;
+
+	const string journal_file = book_file + ".journal";
+	MCTS::PositionStatistics<Move> positions;
+	MCTS::read_position_journal(journal_file, &positions);
+	cerr << positions.size() << " positions read from " << journal_file << "." << endl;
+
+	play_forced_moves(&start_state);
+	vector<State> frontier;
+	if (start_state.has_moves()) {
+		frontier.push_back(start_state);
+	}
+
+	// Enough positions at a time to keep all threads busy while losing
+	// little work if the program is interrupted.
+	const size_t chunk_size = max(1, options.search.number_of_threads);
+
+	for (int ply = 0; ply < options.plies && ! frontier.empty(); ++ply) {
+		vector<State> to_search;
+		for (auto& state: frontier) {
+			if (positions.find(state.get_hash()) == positions.end()) {
+				to_search.push_back(state);
+			}
+		}
+		cerr << "Ply " << ply << ": " << frontier.size() << " positions, "
+		     << to_search.size() << " to search." << endl;
+
+		for (size_t first = 0; first < to_search.size(); first += chunk_size) {
+			auto last = min(first + chunk_size, to_search.size());
+			vector<State> chunk(to_search.begin() + first, to_search.begin() + last);
+			auto statistics = MCTS::compute_root_statistics(chunk, options.search);
+			for (size_t i = 0; i < chunk.size(); ++i) {
+				auto hash = chunk[i].get_hash();
+				positions[hash] = statistics[i];
+				MCTS::append_to_position_journal(journal_file, hash, statistics[i]);
+			}
+		}
+
+		// Follow the most visited moves of every position.
+		vector<State> next_frontier;
+		set<uint64_t> next_hashes;
+		for (auto& state: frontier) {
+			vector<pair<long long, Move>> moves;
+			for (auto& item: positions[state.get_hash()]) {
+				moves.push_back(make_pair(item.second.first, item.first));
+			}
+			sort(moves.rbegin(), moves.rend());
+			if (int(moves.size()) > options.width) {
+				moves.resize(options.width);
+			}
+
+			for (auto& move: moves) {
+				State next_state = state;
+				next_state.do_move(move.second);
+				play_forced_moves(&next_state);
+				if (next_state.has_moves() && next_hashes.insert(next_state.get_hash()).second) {
+					next_frontier.push_back(next_state);
+				}
+			}
+		}
+		frontier.swap(next_frontier);
+	}
+
+	MCTS::write_position_book(positions, book_file);
+	cerr << positions.size() << " positions written to " << book_file << "." << endl;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 3) {
+		cerr << "Usage: " << argv[0] << " <game> <book file> [plies] [iterations] [width] [threads]" << endl
+		     << "  game:       connect_four, go, kalaha or nim." << endl
+		     << "  plies:      depth of the book (default 8)." << endl
+		     << "  iterations: per thread and position (default 100000)." << endl
+		     << "  width:      most visited moves followed per position (default 2)." << endl
+		     << "  threads:    default is the number of cores." << endl;
+		return 1;
+	}
+
+	string game = argv[1];
+	string book_file = argv[2];
+
+	BookOptions options;
+	options.plies = argc > 3 ? atoi(argv[3]) : 8;
+	options.search.max_iterations = argc > 4 ? atoi(argv[4]) : 100000;
+	options.width = argc > 5 ? atoi(argv[5]) : 2;
+	options.search.number_of_threads = argc > 6 ? atoi(argv[6]) : int(thread::hardware_concurrency());
+	if (options.search.number_of_threads <= 0) {
+		options.search.number_of_threads = 8;
+	}
+
+	try {
+		if (game == "connect_four") {
+			build_book(ConnectFourState(), book_file, options);
+		}
+		else if (game == "go") {
+			build_book(GoState<9, 9>(), book_file, options);
+		}
+		else if (game == "kalaha") {
+			build_book(KalahaState<6>(3), book_file, options);
+		}
+		else if (game == "nim") {
+			build_book(NimState(), book_file, options);
+		}
+		else {
+			cerr << "Unknown game: " << game << endl;
+			return 1;
+		}
+	}
+	catch (std::runtime_error& error) {
+		std::cerr << "ERROR: " << error.what() << std::endl;
+		return 1;
+	}
+}
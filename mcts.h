@@ -26,6 +26,9 @@ public:
 	bool has_moves() const;
 	std::vector<Move> get_moves() const;
 
+	// Optional; only needed for position-keyed opening books.
+	std::uint64_t get_hash() const;
+
 	// Returns a value in {0, 0.5, 1}.
 	// This should not be an evaluation function, because it will only be
 	// called for finished games. Return 0.5 to indicate a draw.
@@ -45,6 +48,8 @@ private:
 // player to move.
 //
 
+#include <vector>
+
 namespace MCTS
 {
 struct ComputeOptions
@@ -54,17 +59,70 @@ struct ComputeOptions
 	double max_time;
 	bool verbose;
 
+	// Hybrid root and tree parallelization. The threads are split into
+	// groups of threads_per_tree threads and every group searches one
+	// shared tree. With the default of 1, every thread has its own tree
+	// (plain root parallelization). max_iterations is per thread, so
+	// the total number of games played does not depend on the grouping.
+	// number_of_threads must be a multiple of threads_per_tree.
+	int threads_per_tree;
+	// If positive, the trees exchange their root statistics every
+	// sync_interval iterations instead of only being merged at the end
+	// ("slow tree parallelization"). The statistics of the other trees
+	// are added to the shared nodes and thereby used during selection.
+	int sync_interval;
+	// 1 to share the children of the root, 2 to also share their children.
+	int sync_depth;
+	// Leaf parallelization. Every iteration plays this many games from
+	// the new leaf and backpropagates their sum in one pass, so the
+	// selection walk is paid for once per playouts_per_leaf games.
+	int playouts_per_leaf;
+	// A leaf gets children only after it has been visited this many
+	// times. Larger values give fewer nodes in long searches.
+	int expansion_threshold;
+	// Progressive widening. If the coefficient is positive, a node with
+	// n visits has at most max(1, coefficient * n^exponent) children and
+	// its remaining moves are not considered until then.
+	double progressive_widening_coefficient;
+	double progressive_widening_exponent;
+	// If non-empty, thread t is pinned to CPU cpu_affinity[t % size].
+	// Trees are allocated by the threads searching them, so a group
+	// pinned to one NUMA node also keeps its tree in that node's memory.
+	std::vector<int> cpu_affinity;
+	// A SearchHandle with a progress callback reports every
+	// progress_interval iterations of its first thread and every
+	// progress_time seconds (if positive), and once when it ends.
+	int progress_interval;
+	double progress_time;
+
 	ComputeOptions() :
 		number_of_threads(8),
 		max_iterations(10000),
 		max_time(-1.0), // default is no time limit.
-		verbose(false)
+		verbose(false),
+		threads_per_tree(1),
+		sync_interval(0),
+		sync_depth(1),
+		playouts_per_leaf(1),
+		expansion_threshold(1),
+		progressive_widening_coefficient(0),
+		progressive_widening_exponent(0.5),
+		progress_interval(0),
+		progress_time(1.0)
 	{ }
 };
 
 template<typename State>
 typename State::Move compute_move(const State root_state,
                                   const ComputeOptions options = ComputeOptions());
+
+// Computes the best move for each of the given positions. The searches
+// share one pool of options.number_of_threads threads, so no thread is
+// idle while there is work left for any position. Every position is
+// searched with plain root parallelization.
+template<typename State>
+std::vector<typename State::Move> compute_moves(const std::vector<State>& root_states,
+                                                const ComputeOptions options = ComputeOptions());
 }
 //
 //
@@ -74,12 +132,20 @@ typename State::Move compute_move(const State root_state,
 //
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
 #include <cstdlib>
+#include <deque>
+#include <functional>
 #include <future>
 #include <iomanip>
 #include <iostream>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <new>
 #include <random>
 #include <set>
 #include <sstream>
@@ -91,6 +157,11 @@ typename State::Move compute_move(const State root_state,
 #include <omp.h>
 #endif
 
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 namespace MCTS
 {
 using std::cerr;
@@ -108,57 +179,353 @@ static void assertion_failed(const char* expr, const char* file, int line);
 	#define dattest(expr) ((void)0)
 #endif
 
+// Output formats of Tree::write_tree.
+enum TreeFormat
+{
+	TREE_TEXT,        // The format of Tree::tree_to_string.
+	TREE_JSON_LINES,  // One JSON object per node and line.
+	TREE_GRAPHVIZ     // A Graphviz DOT graph.
+};
+
+template<typename State>
+class Tree;
+
+//
+// A node of the game tree. Nodes live in a Tree, which is needed to
+// get from a node to its parent and children. Other nodes are referred
+// to by 32-bit indices and the untried moves are kept in a pool shared
+// by the whole tree, so a node with an int move is 32 bytes.
 //
-// This class is used to build the game tree. The root is created by the users and
-// the rest of the tree is created by add_node.
+// The visits and wins are packed into one atomic word and may be
+// updated and read by several threads without locking. Wins are stored
+// in fixed point with wins_resolution steps per game.
 //
 template<typename State>
 class Node
 {
 public:
 	typedef typename State::Move Move;
+	typedef std::uint32_t Index;
+	static const Index no_node = 0xffffffffu;
+
+	// Nodes other than the root do not know their moves until
+	// Tree::expand is called. Most leaves are only visited once and
+	// never need them.
+	bool is_expanded() const
+	{
+		return expanded;
+	}
 
-	Node(const State& state);
-	~Node();
+	bool has_untried_moves() const
+	{
+		return number_of_untried_moves > 0;
+	}
 
-	bool has_untried_moves() const;
-	template<typename RandomEngine>
-	Move get_untried_move(RandomEngine* engine) const;
-	Node* best_child() const;
+	int get_number_of_untried_moves() const
+	{
+		return number_of_untried_moves;
+	}
+
+	int get_number_of_children() const
+	{
+		return number_of_children;
+	}
 
 	bool has_children() const
 	{
-		return ! children.empty();
+		return first_child.load(std::memory_order_acquire) != no_node;
+	}
+
+	// The number of moves from a node is limited so that the move
+	// counts fit next to player_to_move.
+	static const int max_moves = (1 << 11) - 1;
+	// The visits of a node must not exceed max_visits. Searches stop
+	// once the root has half as many, which leaves room for the games
+	// still being played by other threads or imported from other trees.
+	static const int max_visits = (1 << 30) - 1;
+	static const int wins_resolution = 16;
+
+	int visits() const
+	{
+		return int(statistics.load(std::memory_order_relaxed) >> wins_bits);
+	}
+
+	double wins() const
+	{
+		return double(statistics.load(std::memory_order_relaxed) & wins_mask) / wins_resolution;
 	}
 
-	Node* select_child_UCT() const;
-	Node* add_child(const Move& move, const State& state);
-	void update(double result);
+	// Reads the visits and wins from the same moment.
+	void get_statistics(int* visits, double* wins) const
+	{
+		auto packed = statistics.load(std::memory_order_relaxed);
+		*visits = int(packed >> wins_bits);
+		*wins = double(packed & wins_mask) / wins_resolution;
+	}
+
+	// Adds number_of_games games with result as the sum of their results.
+	void update(double result, int number_of_games = 1)
+	{
+		add_statistics(number_of_games, result);
+	}
+
+	// Like update, but the numbers may be negative as long as the
+	// totals stay non-negative.
+	void add_statistics(long long visits, double wins)
+	{
+		auto fixed_wins = std::llround(wins * wins_resolution);
+		statistics.fetch_add((std::uint64_t(visits) << wins_bits) + std::uint64_t(fixed_wins),
+		                     std::memory_order_relaxed);
+	}
 
 	std::string to_string() const;
-	std::string tree_to_string(int max_depth = 1000000, int indent = 0) const;
 
 	const Move move;
-	Node* const parent;
-	const int player_to_move;
+	const std::int8_t player_to_move;
 
-	//std::atomic<double> wins;
-	//std::atomic<int> visits;
-	double wins;
-	int visits;
+private:
+	friend class Tree<State>;
 
-	std::vector<Move> moves;
-	std::vector<Node*> children;
+	// The wins fit in wins_bits bits as long as they do not exceed the
+	// visits.
+	static const int wins_bits = 34;
+	static const std::uint64_t wins_mask = (std::uint64_t(1) << wins_bits) - 1;
 
-private:
-	Node(const State& state, const Move& move, Node* parent);
+	Node(int player_to_move, const Move& move, Index parent);
 
-	std::string indent_string(int indent) const;
+	void write_node(std::ostream& out) const;
 
 	Node(const Node&);
 	Node& operator = (const Node&);
 
-	double UCT_score;
+	std::uint32_t expanded : 1;
+	std::uint32_t number_of_untried_moves : 11;
+	std::uint32_t number_of_children : 11;
+	Index parent;
+	// Written last when a child is added, so that other threads can
+	// walk the children while the tree grows.
+	std::atomic<Index> first_child;
+	Index next_sibling;
+	Index first_untried_move;
+	std::atomic<std::uint64_t> statistics;
+};
+
+template<typename State>
+const typename Node<State>::Index Node<State>::no_node;
+template<typename State>
+const int Node<State>::max_moves;
+template<typename State>
+const int Node<State>::max_visits;
+template<typename State>
+const int Node<State>::wins_resolution;
+template<typename State>
+const int Node<State>::wins_bits;
+template<typename State>
+const std::uint64_t Node<State>::wins_mask;
+
+//
+// A game tree. The root is created from a state by the constructor and
+// the rest of the tree by add_child.
+//
+// The nodes are allocated in chunks of doubling size that are never
+// moved, so pointers to nodes stay valid while the tree grows.
+//
+template<typename State>
+class Tree
+{
+public:
+	typedef typename State::Move Move;
+	typedef typename Node<State>::Index Index;
+
+	// Iterates over the children of a node, most recently added first.
+	class ChildIterator
+	{
+	public:
+		ChildIterator(const Tree* tree_, Node<State>* node_) :
+			tree(tree_),
+			node(node_)
+		{ }
+
+		Node<State>* operator * () const
+		{
+			return node;
+		}
+
+		ChildIterator& operator ++ ()
+		{
+			node = tree->next_sibling(node);
+			return *this;
+		}
+
+		bool operator != (const ChildIterator& other) const
+		{
+			return node != other.node;
+		}
+
+	private:
+		const Tree* tree;
+		Node<State>* node;
+	};
+
+	class Children
+	{
+	public:
+		Children(const Tree* tree_, const Node<State>* parent_) :
+			tree(tree_),
+			parent(parent_)
+		{ }
+
+		ChildIterator begin() const
+		{
+			return ChildIterator(tree, tree->first_child(parent));
+		}
+
+		ChildIterator end() const
+		{
+			return ChildIterator(tree, nullptr);
+		}
+
+		size_t size() const
+		{
+			size_t count = 0;
+			for (auto itr = begin(); itr != end(); ++itr) {
+				++count;
+			}
+			return count;
+		}
+
+	private:
+		const Tree* tree;
+		const Node<State>* parent;
+	};
+
+	Tree(const State& root_state);
+	~Tree();
+
+	Node<State>* root() const
+	{
+		return get(0);
+	}
+
+	// The number of nodes in the tree. May be called while another
+	// thread adds nodes.
+	size_t size() const
+	{
+		return number_of_nodes.load(std::memory_order_relaxed);
+	}
+
+	Node<State>* parent(const Node<State>* node) const
+	{
+		return node->parent == Node<State>::no_node ? nullptr : get(node->parent);
+	}
+
+	Node<State>* first_child(const Node<State>* node) const
+	{
+		auto index = node->first_child.load(std::memory_order_acquire);
+		return index == Node<State>::no_node ? nullptr : get(index);
+	}
+
+	Node<State>* next_sibling(const Node<State>* node) const
+	{
+		return node->next_sibling == Node<State>::no_node ? nullptr : get(node->next_sibling);
+	}
+
+	Children children(const Node<State>* node) const
+	{
+		return Children(this, node);
+	}
+
+	std::vector<Move> get_untried_moves(const Node<State>* node) const;
+
+	// Generates the moves of a node. The state is that of the node.
+	void expand(Node<State>* node, const State& state);
+
+	// Removes a random untried move from node and returns it.
+	template<typename RandomEngine>
+	Move take_untried_move(Node<State>* node, RandomEngine* engine);
+	// Removes move from the untried moves of node. Returns false if it
+	// is not one of them.
+	bool take_untried_move(Node<State>* node, const Move& move);
+
+	// Adds a child for a move taken from the untried moves of node. The
+	// state is that of the new child.
+	Node<State>* add_child(Node<State>* node, const Move& move, const State& state);
+
+	Node<State>* best_child(const Node<State>* node) const;
+	Node<State>* select_child_UCT(const Node<State>* node) const;
+	// Returns the child of node with the given move, or nullptr.
+	Node<State>* find_child(const Node<State>* node, const Move& move) const;
+
+	// Copies node and everything below it into a new tree with node as
+	// its root, so that a search can continue from there. The state is
+	// that of node. Must not be called while the tree grows.
+	std::unique_ptr<Tree> subtree(const Node<State>* node, const State& state) const;
+
+	std::string tree_to_string(int max_depth = 1000000, int indent = 0) const;
+
+	// Writes the tree directly to a stream. Nodes at depth max_depth or
+	// deeper, and nodes other than the root with fewer than min_visits
+	// visits, are left out together with their subtrees. Moves are
+	// written with operator <<; for JSON they must print as JSON values,
+	// which numbers do.
+	void write_tree(std::ostream& out,
+	                TreeFormat format = TREE_TEXT,
+	                int max_depth = 1000000,
+	                int min_visits = 0) const;
+
+private:
+	// Chunk c holds 2^(first_chunk_bits + c) nodes. Enough chunks for
+	// every 32-bit index.
+	static const int first_chunk_bits = 10;
+	static const int max_chunks = 33 - first_chunk_bits;
+
+	static int floor_log2(std::uint64_t x)
+	{
+		#ifdef __GNUC__
+		return 63 - __builtin_clzll(x);
+		#else
+		int result = 0;
+		while (x >>= 1) {
+			++result;
+		}
+		return result;
+		#endif
+	}
+
+	static std::uint64_t chunk_start(int chunk)
+	{
+		return (std::uint64_t(1) << (first_chunk_bits + chunk)) - (std::uint64_t(1) << first_chunk_bits);
+	}
+
+	Node<State>* get(Index index) const
+	{
+		auto position = std::uint64_t(index) + (std::uint64_t(1) << first_chunk_bits);
+		int chunk = floor_log2(position) - first_chunk_bits;
+		return chunks[chunk] + (index - chunk_start(chunk));
+	}
+
+	Index index_of(const Node<State>* node) const;
+	Node<State>* allocate(int player_to_move, const Move& move, Index parent);
+	Node<State>* copy_subtree(const Tree& source, const Node<State>* node, Index parent);
+
+	void write_subtree(std::ostream& out,
+	                   const Node<State>* node,
+	                   TreeFormat format,
+	                   int max_depth,
+	                   int min_visits,
+	                   int depth,
+	                   long long parent_id,
+	                   long long* next_id) const;
+
+	// An empty tree, for subtree.
+	Tree();
+
+	Tree(const Tree&);
+	Tree& operator = (const Tree&);
+
+	Node<State>* chunks[max_chunks];
+	std::atomic<size_t> number_of_nodes;
+	std::vector<Move> move_pool;
 };
 
 
@@ -167,289 +534,1155 @@ private:
 
 
 template<typename State>
-Node<State>::Node(const State& state) :
-	move(State::no_move),
-	parent(nullptr),
-	player_to_move(state.player_to_move),
-	wins(0),
-	visits(0),
-	moves(state.get_moves()),
-	UCT_score(0)
-{ }
-
-template<typename State>
-Node<State>::Node(const State& state, const Move& move_, Node* parent_) :
+Node<State>::Node(int player_to_move_, const Move& move_, Index parent_) :
 	move(move_),
+	player_to_move(std::int8_t(player_to_move_)),
+	expanded(0),
+	number_of_untried_moves(0),
+	number_of_children(0),
 	parent(parent_),
-	player_to_move(state.player_to_move),
-	wins(0),
-	visits(0),
-	moves(state.get_moves()),
-	UCT_score(0)
+	first_child(no_node),
+	next_sibling(no_node),
+	first_untried_move(0),
+	statistics(0)
 { }
 
 template<typename State>
-Node<State>::~Node()
+std::string Node<State>::to_string() const
+{
+	std::stringstream sout;
+	write_node(sout);
+	return sout.str();
+}
+
+template<typename State>
+void Node<State>::write_node(std::ostream& out) const
+{
+	out << "["
+	    << "P" << 3 - player_to_move << " "
+	    << "M:" << move << " "
+	    << "W/V: " << wins() << "/" << visits() << " "
+	    << "U: " << number_of_untried_moves << "]\n";
+}
+
+template<typename State>
+Tree<State>::Tree(const State& state) :
+	number_of_nodes(0)
 {
-	for (auto child: children) {
-		delete child;
+	for (int c = 0; c < max_chunks; ++c) {
+		chunks[c] = nullptr;
 	}
+	expand(allocate(state.player_to_move, Move(State::no_move), Node<State>::no_node), state);
 }
 
 template<typename State>
-bool Node<State>::has_untried_moves() const
+Tree<State>::Tree() :
+	number_of_nodes(0)
 {
-	return ! moves.empty();
+	for (int c = 0; c < max_chunks; ++c) {
+		chunks[c] = nullptr;
+	}
 }
 
 template<typename State>
-template<typename RandomEngine>
-typename State::Move Node<State>::get_untried_move(RandomEngine* engine) const
+Tree<State>::~Tree()
+{
+	// Nodes have trivial destructors.
+	for (int c = 0; c < max_chunks; ++c) {
+		::operator delete(chunks[c]);
+	}
+}
+
+template<typename State>
+Node<State>* Tree<State>::allocate(int player_to_move, const Move& move, Index parent)
 {
-	attest( ! moves.empty());
-	std::uniform_int_distribution<std::size_t> moves_distribution(0, moves.size() - 1);
-	return moves[moves_distribution(*engine)];
+	const auto index = Index(number_of_nodes.load(std::memory_order_relaxed));
+	attest(index < Node<State>::no_node);
+	int chunk = floor_log2(std::uint64_t(index) + (std::uint64_t(1) << first_chunk_bits)) - first_chunk_bits;
+	if (chunks[chunk] == nullptr) {
+		auto chunk_size = std::size_t(1) << (first_chunk_bits + chunk);
+		chunks[chunk] = static_cast<Node<State>*>(::operator new(chunk_size * sizeof(Node<State>)));
+	}
+	number_of_nodes.store(index + 1, std::memory_order_relaxed);
+	return new (get(index)) Node<State>(player_to_move, move, parent);
 }
 
 template<typename State>
-Node<State>* Node<State>::best_child() const
+std::unique_ptr<Tree<State>> Tree<State>::subtree(const Node<State>* node, const State& state) const
 {
-	attest(moves.empty());
-	attest( ! children.empty() );
+	attest(node->player_to_move == state.player_to_move);
+	std::unique_ptr<Tree> tree(new Tree());
+	auto root = tree->copy_subtree(*this, node, Node<State>::no_node);
+	if ( ! root->expanded) {
+		tree->expand(root, state);
+	}
+	return tree;
+}
 
-	return *std::max_element(children.begin(), children.end(),
-		[](Node* a, Node* b) { return a->visits < b->visits; });;
+template<typename State>
+Node<State>* Tree<State>::copy_subtree(const Tree& source, const Node<State>* node, Index parent)
+{
+	// The root of a tree has no move.
+	auto copy = allocate(node->player_to_move,
+	                     parent == Node<State>::no_node ? Move(State::no_move) : node->move,
+	                     parent);
+	copy->expanded = node->expanded;
+	copy->number_of_untried_moves = node->number_of_untried_moves;
+	copy->first_untried_move = Index(move_pool.size());
+	auto first = source.move_pool.begin() + node->first_untried_move;
+	move_pool.insert(move_pool.end(), first, first + node->number_of_untried_moves);
+	copy->statistics.store(node->statistics.load(std::memory_order_relaxed), std::memory_order_relaxed);
+
+	// Children are prepended, so they are copied in reverse to keep
+	// their order.
+	std::vector<const Node<State>*> source_children;
+	for (auto child: source.children(node)) {
+		source_children.push_back(child);
+	}
+	const auto copy_index = index_of(copy);
+	for (auto itr = source_children.rbegin(); itr != source_children.rend(); ++itr) {
+		auto child = copy_subtree(source, *itr, copy_index);
+		child->next_sibling = copy->first_child.load(std::memory_order_relaxed);
+		copy->first_child.store(index_of(child), std::memory_order_relaxed);
+		++copy->number_of_children;
+	}
+	return copy;
 }
 
 template<typename State>
-Node<State>* Node<State>::select_child_UCT() const
+typename Tree<State>::Index Tree<State>::index_of(const Node<State>* node) const
 {
-	attest( ! children.empty() );
-	for (auto child: children) {
-		child->UCT_score = double(child->wins) / double(child->visits) +
-			std::sqrt(2.0 * std::log(double(this->visits)) / child->visits);
+	std::less<const Node<State>*> less;
+	for (int c = 0; c < max_chunks && chunks[c] != nullptr; ++c) {
+		auto chunk_size = std::size_t(1) << (first_chunk_bits + c);
+		if ( ! less(node, chunks[c]) && less(node, chunks[c] + chunk_size)) {
+			return Index(chunk_start(c) + (node - chunks[c]));
+		}
 	}
+	attest(false);
+	return Node<State>::no_node;
+}
 
-	return *std::max_element(children.begin(), children.end(),
-		[](Node* a, Node* b) { return a->UCT_score < b->UCT_score; });
+template<typename State>
+void Tree<State>::expand(Node<State>* node, const State& state)
+{
+	attest( ! node->expanded);
+	auto moves = state.get_moves();
+	attest(moves.size() <= std::size_t(Node<State>::max_moves));
+	node->first_untried_move = Index(move_pool.size());
+	node->number_of_untried_moves = std::uint32_t(moves.size());
+	move_pool.insert(move_pool.end(), moves.begin(), moves.end());
+	node->expanded = 1;
 }
 
 template<typename State>
-Node<State>* Node<State>::add_child(const Move& move, const State& state)
+std::vector<typename State::Move> Tree<State>::get_untried_moves(const Node<State>* node) const
 {
-	auto node = new Node(state, move, this);
-	children.push_back(node);
-	attest( ! children.empty());
+	auto first = move_pool.begin() + node->first_untried_move;
+	return std::vector<Move>(first, first + node->number_of_untried_moves);
+}
 
-	auto itr = moves.begin();
-	for (; itr != moves.end() && *itr != move; ++itr);
-	attest(itr != moves.end());
-	moves.erase(itr);
-	return node;
+template<typename State>
+template<typename RandomEngine>
+typename State::Move Tree<State>::take_untried_move(Node<State>* node, RandomEngine* engine)
+{
+	attest(node->has_untried_moves());
+	std::uniform_int_distribution<std::size_t> moves_distribution(0, node->number_of_untried_moves - 1);
+	auto first = move_pool.begin() + node->first_untried_move;
+	auto last = first + --node->number_of_untried_moves;
+	std::iter_swap(first + moves_distribution(*engine), last);
+	return *last;
 }
 
 template<typename State>
-void Node<State>::update(double result)
+bool Tree<State>::take_untried_move(Node<State>* node, const Move& move)
 {
-	visits++;
+	auto first = move_pool.begin() + node->first_untried_move;
+	auto last = first + node->number_of_untried_moves;
+	auto itr = std::find(first, last, move);
+	if (itr == last) {
+		return false;
+	}
+	std::iter_swap(itr, last - 1);
+	--node->number_of_untried_moves;
+	return true;
+}
 
-	wins += result;
-	//double my_wins = wins.load();
-	//while ( ! wins.compare_exchange_strong(my_wins, my_wins + result));
+template<typename State>
+Node<State>* Tree<State>::add_child(Node<State>* node, const Move& move, const State& state)
+{
+	auto child = allocate(state.player_to_move, move, index_of(node));
+	child->next_sibling = node->first_child.load(std::memory_order_relaxed);
+	node->first_child.store(index_of(child), std::memory_order_release);
+	++node->number_of_children;
+	return child;
 }
 
 template<typename State>
-std::string Node<State>::to_string() const
+Node<State>* Tree<State>::best_child(const Node<State>* node) const
+{
+	attest(node->has_children());
+
+	Node<State>* best = nullptr;
+	for (auto child: children(node)) {
+		if (best == nullptr || child->visits() > best->visits()) {
+			best = child;
+		}
+	}
+	return best;
+}
+
+template<typename State>
+Node<State>* Tree<State>::select_child_UCT(const Node<State>* node) const
+{
+	attest(node->has_children());
+
+	const double log_visits = std::log(double(node->visits()));
+	Node<State>* best = nullptr;
+	double best_score = 0;
+	for (auto child: children(node)) {
+		int visits;
+		double wins;
+		child->get_statistics(&visits, &wins);
+		double score = wins / double(visits) + std::sqrt(2.0 * log_visits / visits);
+		if (best == nullptr || score > best_score) {
+			best = child;
+			best_score = score;
+		}
+	}
+	return best;
+}
+
+template<typename State>
+Node<State>* Tree<State>::find_child(const Node<State>* node, const Move& move) const
+{
+	for (auto child: children(node)) {
+		if (child->move == move) {
+			return child;
+		}
+	}
+	return nullptr;
+}
+
+template<typename State>
+std::string Tree<State>::tree_to_string(int max_depth, int indent) const
 {
 	std::stringstream sout;
-	sout << "["
-	     << "P" << 3 - player_to_move << " "
-	     << "M:" << move << " "
-	     << "W/V: " << wins << "/" << visits << " "
-	     << "U: " << moves.size() << "]\n";
+	long long next_id = 0;
+	write_subtree(sout, root(), TREE_TEXT, max_depth, 0, indent, -1, &next_id);
 	return sout.str();
 }
 
 template<typename State>
-std::string Node<State>::tree_to_string(int max_depth, int indent) const
+void Tree<State>::write_tree(std::ostream& out,
+                             TreeFormat format,
+                             int max_depth,
+                             int min_visits) const
 {
-	if (indent >= max_depth) {
-		return "";
+	if (format == TREE_GRAPHVIZ) {
+		out << "digraph tree {\n";
 	}
-
-	std::string s = indent_string(indent) + to_string();
-	for (auto child: children) {
-		s += child->tree_to_string(max_depth, indent + 1);
+	long long next_id = 0;
+	write_subtree(out, root(), format, max_depth, min_visits, 0, -1, &next_id);
+	if (format == TREE_GRAPHVIZ) {
+		out << "}\n";
 	}
-	return s;
 }
 
 template<typename State>
-std::string Node<State>::indent_string(int indent) const
+void Tree<State>::write_subtree(std::ostream& out,
+                                const Node<State>* node,
+                                TreeFormat format,
+                                int max_depth,
+                                int min_visits,
+                                int depth,
+                                long long parent_id,
+                                long long* next_id) const
 {
-	std::string s = "";
-	for (int i = 1; i <= indent; ++i) {
-		s += "| ";
+	if (depth >= max_depth || (parent_id >= 0 && node->visits() < min_visits)) {
+		return;
+	}
+
+	const long long id = (*next_id)++;
+	switch (format) {
+	case TREE_TEXT:
+		for (int i = 1; i <= depth; ++i) {
+			out << "| ";
+		}
+		node->write_node(out);
+		break;
+
+	case TREE_JSON_LINES:
+		out << "{\"id\":" << id << ",\"parent\":";
+		if (parent_id >= 0) {
+			out << parent_id;
+		}
+		else {
+			out << "null";
+		}
+		out << ",\"depth\":" << depth
+		    << ",\"player\":" << 3 - node->player_to_move
+		    << ",\"move\":" << node->move
+		    << ",\"wins\":" << node->wins()
+		    << ",\"visits\":" << node->visits()
+		    << ",\"untried\":" << node->number_of_untried_moves << "}\n";
+		break;
+
+	case TREE_GRAPHVIZ:
+		out << "\tn" << id << " [label=\"P" << 3 - node->player_to_move << " M:" << node->move
+		    << "\\nW/V: " << node->wins() << "/" << node->visits() << "\"];\n";
+		if (parent_id >= 0) {
+			out << "\tn" << parent_id << " -> n" << id << ";\n";
+		}
+		break;
+	}
+
+	for (auto child: children(node)) {
+		write_subtree(out, child, format, max_depth, min_visits, depth + 1, id, next_id);
 	}
-	return s;
 }
 
 /////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////
 
 
-template<typename State>
-std::unique_ptr<Node<State>>  compute_tree(const State root_state,
-                                           const ComputeOptions options,
-                                           std::mt19937_64::result_type initial_seed)
+//
+// A fixed number of threads working through a set of tasks known in
+// advance. Every thread owns a deque; it takes tasks from the back of
+// its own deque and, when that is empty, steals from the front of the
+// others.
+//
+class WorkStealingPool
 {
-	std::mt19937_64 random_engine(initial_seed);
+public:
+	typedef std::function<void()> Task;
 
-	attest(options.max_iterations >= 0 || options.max_time >= 0);
-	if (options.max_time >= 0) {
-		#ifndef USE_OPENMP
-		throw std::runtime_error("ComputeOptions::max_time requires OpenMP.");
-		#endif
+	WorkStealingPool(int number_of_threads) :
+		queues(number_of_threads),
+		next_queue(0)
+	{
+		attest(number_of_threads >= 1);
 	}
-	// Will support more players later.
-	attest(root_state.player_to_move == 1 || root_state.player_to_move == 2);
-	auto root = std::unique_ptr<Node<State>>(new Node<State>(root_state));
-
-	#ifdef USE_OPENMP
-	double start_time = ::omp_get_wtime();
-	double print_time = start_time;
-	#endif
 
-	for (int iter = 1; iter <= options.max_iterations || options.max_iterations < 0; ++iter) {
-		auto node = root.get();
-		State state = root_state;
+	// Adds a task to the deques in turn. Tasks of different lengths are
+	// balanced by the stealing.
+	void add(Task task)
+	{
+		queues[next_queue].tasks.push_back(std::move(task));
+		next_queue = (next_queue + 1) % queues.size();
+	}
 
-		// Select a path through the tree to a leaf node.
-		while (!node->has_untried_moves() && node->has_children()) {
-			node = node->select_child_UCT();
-			state.do_move(node->move);
+	// Runs all tasks and returns when every task has finished. The first
+	// exception thrown by a task is rethrown here.
+	void run()
+	{
+		std::vector<std::future<void>> workers;
+		for (size_t t = 0; t < queues.size(); ++t) {
+			workers.push_back(std::async(std::launch::async, [this, t] () { work(t); }));
 		}
-
-		// If we are not already at the final state, expand the
-		// tree with a new node and move there.
-		if (node->has_untried_moves()) {
-			auto move = node->get_untried_move(&random_engine);
-			state.do_move(move);
-			node = node->add_child(move, state);
+		for (auto& worker: workers) {
+			worker.wait();
 		}
-
-		// We now play randomly until the game ends.
-		while (state.has_moves()) {
-			state.do_random_move(&random_engine);
+		for (auto& worker: workers) {
+			worker.get();
 		}
+	}
 
-		// We have now reached a final state. Backpropagate the result
-		// up the tree to the root node.
-		while (node != nullptr) {
-			node->update(state.get_result(node->player_to_move));
-			node = node->parent;
+private:
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	void work(size_t own)
+	{
+		Task task;
+		while (take(own, &task)) {
+			task();
 		}
+	}
 
-		#ifdef USE_OPENMP
-		if (options.verbose || options.max_time >= 0) {
-			double time = ::omp_get_wtime();
-			if (options.verbose && (time - print_time >= 1.0 || iter == options.max_iterations)) {
-				std::cerr << iter << " games played (" << double(iter) / (time - start_time) << " / second)." << endl;
-				print_time = time;
+	bool take(size_t own, Task* task)
+	{
+		{
+			std::lock_guard<std::mutex> lock(queues[own].mutex);
+			if ( ! queues[own].tasks.empty()) {
+				*task = std::move(queues[own].tasks.back());
+				queues[own].tasks.pop_back();
+				return true;
 			}
+		}
 
-			if (time - start_time >= options.max_time) {
-				break;
+		// No new tasks are added during run(), so all deques being empty
+		// means that there is nothing left to do.
+		for (size_t i = 1; i < queues.size(); ++i) {
+			auto& victim = queues[(own + i) % queues.size()];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			if ( ! victim.tasks.empty()) {
+				*task = std::move(victim.tasks.front());
+				victim.tasks.pop_front();
+				return true;
 			}
 		}
-		#endif
+		return false;
 	}
 
-	return root;
-}
+	std::vector<Queue> queues;
+	size_t next_queue;
 
-template<typename State>
-typename State::Move compute_move(const State root_state,
-                                  const ComputeOptions options)
-{
-	using namespace std;
+	WorkStealingPool(const WorkStealingPool&);
+	WorkStealingPool& operator = (const WorkStealingPool&);
+};
+
+/////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////
+
+
+// Selects a path through the tree to a leaf node and, if the leaf is
+// not a final state, expands the tree with a new node there. The moves
+// along the path are played in state. Returns the new node.
+template<typename State, typename RandomEngine>
+Node<State>* select_and_expand(Tree<State>* tree,
+                               State* state,
+                               RandomEngine* engine,
+                               const ComputeOptions& options)
+{
+	auto node = tree->root();
+
+	while (true) {
+		// The moves of a node are generated, and its children created,
+		// only after it has been visited expansion_threshold times.
+		// Until then, the games are played from the node itself.
+		if ( ! node->is_expanded()) {
+			if (node->visits() < options.expansion_threshold) {
+				return node;
+			}
+			tree->expand(node, *state);
+		}
 
+		// If we are not already at the final state, expand the
+		// tree with a new node and move there. With progressive
+		// widening, the number of children grows with the visits.
+		bool may_add_child = true;
+		if (options.progressive_widening_coefficient > 0) {
+			double max_children = std::floor(options.progressive_widening_coefficient *
+				std::pow(double(node->visits()), options.progressive_widening_exponent));
+			may_add_child = node->get_number_of_children() < std::max(1.0, max_children);
+		}
+		if (node->has_untried_moves() && (may_add_child || ! node->has_children())) {
+			auto move = tree->take_untried_move(node, engine);
+			state->do_move(move);
+			return tree->add_child(node, move, *state);
+		}
+
+		if ( ! node->has_children()) {
+			// Final state.
+			return node;
+		}
+
+		node = tree->select_child_UCT(node);
+		state->do_move(node->move);
+	}
+}
+
+// Plays number_of_games random games from state until they end and
+// returns the sum of their results for player 1 and player 2. The last
+// game is played in state itself.
+template<typename State, typename RandomEngine>
+std::pair<double, double> play_out(State* state, int number_of_games, RandomEngine* engine)
+{
+	attest(number_of_games >= 1);
+	std::pair<double, double> results(0, 0);
+
+	for (int game = 1; game < number_of_games; ++game) {
+		State copy = *state;
+		while (copy.has_moves()) {
+			copy.do_random_move(engine);
+		}
+		results.first  += copy.get_result(1);
+		results.second += copy.get_result(2);
+	}
+
+	while (state->has_moves()) {
+		state->do_random_move(engine);
+	}
+	results.first  += state->get_result(1);
+	results.second += state->get_result(2);
+	return results;
+}
+
+// Searches tree, whose root state is root_state, with a single thread
+// until the budget of the options is spent or *stop becomes true.
+// report_progress is called as given by options.progress_interval and
+// options.progress_time.
+template<typename State>
+void search_tree(Tree<State>* tree,
+                 const State& root_state,
+                 const ComputeOptions& options,
+                 std::mt19937_64::result_type initial_seed,
+                 const std::atomic<bool>* stop = nullptr,
+                 const std::function<void()>* report_progress = nullptr)
+{
+	std::mt19937_64 random_engine(initial_seed);
+	auto report_time = std::chrono::steady_clock::now();
+
+	attest(options.max_iterations >= 0 || options.max_time >= 0 || stop != nullptr);
+	if (options.max_time >= 0) {
+		#ifndef USE_OPENMP
+		throw std::runtime_error("ComputeOptions::max_time requires OpenMP.");
+		#endif
+	}
 	// Will support more players later.
 	attest(root_state.player_to_move == 1 || root_state.player_to_move == 2);
 
-	auto moves = root_state.get_moves();
-	attest(moves.size() > 0);
-	if (moves.size() == 1) {
-		return moves[0];
+	#ifdef USE_OPENMP
+	double start_time = ::omp_get_wtime();
+	double print_time = start_time;
+	#endif
+
+	for (long long iter = 1; iter <= options.max_iterations || options.max_iterations < 0; ++iter) {
+		if (stop != nullptr && stop->load(std::memory_order_relaxed)) {
+			break;
+		}
+		if (tree->root()->visits() >= Node<State>::max_visits / 2) {
+			break;
+		}
+
+		State state = root_state;
+		auto node = select_and_expand(tree, &state, &random_engine, options);
+
+		// We now play randomly until the game ends.
+		auto results = play_out(&state, options.playouts_per_leaf, &random_engine);
+
+		// We have now reached a final state. Backpropagate the result
+		// up the tree to the root node.
+		while (node != nullptr) {
+			node->update(node->player_to_move == 1 ? results.first : results.second,
+			             options.playouts_per_leaf);
+			node = tree->parent(node);
+		}
+
+		if (report_progress != nullptr) {
+			auto now = std::chrono::steady_clock::now();
+			if ((options.progress_interval > 0 && iter % options.progress_interval == 0) ||
+			    (options.progress_time > 0 &&
+			     std::chrono::duration<double>(now - report_time).count() >= options.progress_time)) {
+				(*report_progress)();
+				report_time = now;
+			}
+		}
+
+		#ifdef USE_OPENMP
+		if (options.verbose || options.max_time >= 0) {
+			double time = ::omp_get_wtime();
+			if (options.verbose && (time - print_time >= 1.0 || iter == options.max_iterations)) {
+				long long games = iter * options.playouts_per_leaf;
+				std::cerr << games << " games played (" << double(games) / (time - start_time) << " / second)." << endl;
+				print_time = time;
+			}
+
+			if (options.max_time >= 0 && time - start_time >= options.max_time) {
+				break;
+			}
+		}
+		#endif
+	}
+}
+
+template<typename State>
+std::unique_ptr<Tree<State>>  compute_tree(const State root_state,
+                                           const ComputeOptions options,
+                                           std::mt19937_64::result_type initial_seed)
+{
+	auto tree = std::unique_ptr<Tree<State>>(new Tree<State>(root_state));
+	search_tree(tree.get(), root_state, options, initial_seed);
+	return tree;
+}
+
+// The number of visits and wins for each move at the root.
+template<typename Move>
+using RootStatistics = std::map<Move, std::pair<long long, double>>;
+
+//
+// Statistics of a fixed set of nodes close to the root, identified by
+// their move sequences from the root, as published by each of the trees
+// of a parallel search. Every tree only writes to its own slot and the
+// slots are read under a sequence lock. Writers never block; a reader
+// that sees a write in progress yields and retries.
+//
+template<typename State>
+class SharedStatistics
+{
+public:
+	typedef typename State::Move Move;
+
+	// With depth 1, the children of the root are shared. With depth 2,
+	// their children are shared as well.
+	SharedStatistics(const State& root_state, int depth, int number_of_trees)
+	{
+		attest(depth == 1 || depth == 2);
+		for (auto move: root_state.get_moves()) {
+			paths.push_back(std::vector<Move>(1, move));
+			if (depth >= 2) {
+				State state = root_state;
+				state.do_move(move);
+				for (auto reply: state.get_moves()) {
+					std::vector<Move> path(1, move);
+					path.push_back(reply);
+					paths.push_back(path);
+				}
+			}
+		}
+
+		for (int t = 0; t < number_of_trees; ++t) {
+			slots.emplace_back(new Slot(paths.size()));
+		}
+	}
+
+	size_t size() const
+	{
+		return paths.size();
+	}
+
+	const std::vector<Move>& path(size_t i) const
+	{
+		return paths[i];
+	}
+
+	// Publishes the statistics of one tree. Only called by the threads
+	// of that tree, one at a time.
+	void publish(int tree, const std::vector<long long>& visits, const std::vector<double>& wins)
+	{
+		auto& slot = *slots[tree];
+		auto sequence = slot.sequence.load(std::memory_order_relaxed);
+		slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		for (size_t i = 0; i < paths.size(); ++i) {
+			slot.visits[i].store(visits[i], std::memory_order_relaxed);
+			slot.wins[i].store(wins[i], std::memory_order_relaxed);
+		}
+		slot.sequence.store(sequence + 2, std::memory_order_release);
+	}
+
+	// Computes the sum of the statistics published by all other trees.
+	void sum_of_others(int tree, std::vector<long long>* visits, std::vector<double>* wins) const
+	{
+		visits->assign(paths.size(), 0);
+		wins->assign(paths.size(), 0);
+		std::vector<long long> slot_visits(paths.size());
+		std::vector<double> slot_wins(paths.size());
+
+		for (int t = 0; t < int(slots.size()); ++t) {
+			if (t == tree) {
+				continue;
+			}
+
+			auto& slot = *slots[t];
+			while (true) {
+				auto before = slot.sequence.load(std::memory_order_acquire);
+				if (before % 2 != 0) {
+					// A write is in progress.
+					std::this_thread::yield();
+					continue;
+				}
+				for (size_t i = 0; i < paths.size(); ++i) {
+					slot_visits[i] = slot.visits[i].load(std::memory_order_relaxed);
+					slot_wins[i] = slot.wins[i].load(std::memory_order_relaxed);
+				}
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if (slot.sequence.load(std::memory_order_relaxed) == before) {
+					break;
+				}
+			}
+
+			for (size_t i = 0; i < paths.size(); ++i) {
+				(*visits)[i] += slot_visits[i];
+				(*wins)[i]   += slot_wins[i];
+			}
+		}
+	}
+
+private:
+	struct Slot
+	{
+		Slot(size_t size) :
+			sequence(0),
+			visits(size),
+			wins(size)
+		{ }
+
+		std::atomic<unsigned long long> sequence;
+		std::vector<std::atomic<long long>> visits;
+		std::vector<std::atomic<double>> wins;
+	};
+
+	std::vector<std::vector<Move>> paths;
+	std::vector<std::unique_ptr<Slot>> slots;
+};
+
+//
+// A tree searched by a group of threads. The shape of the tree and all
+// members are protected by the mutex. The node statistics are atomic
+// and are updated without it.
+//
+template<typename State>
+struct SharedTree
+{
+	SharedTree(const State& root_state, size_t number_of_shared_nodes) :
+		game_tree(new Tree<State>(root_state)),
+		iterations(0),
+		imported_visits(number_of_shared_nodes, 0),
+		imported_wins(number_of_shared_nodes, 0)
+	{ }
+
+	std::unique_ptr<Tree<State>> game_tree;
+	long long iterations;
+	// The statistics of the other trees that have been added to the
+	// shared nodes of this tree.
+	std::vector<long long> imported_visits;
+	std::vector<double> imported_wins;
+	std::mutex mutex;
+};
+
+// Publishes the statistics found by this tree and replaces the
+// statistics previously imported from the other trees with their
+// current ones.
+template<typename State>
+void synchronize_shared_nodes(const State& root_state,
+                              SharedTree<State>* tree,
+                              int tree_index,
+                              SharedStatistics<State>* shared)
+{
+	auto game_tree = tree->game_tree.get();
+	auto root = game_tree->root();
+	const size_t size = shared->size();
+
+	std::vector<Node<State>*> nodes(size, nullptr);
+	std::vector<long long> visits(size, 0);
+	std::vector<double> wins(size, 0);
+	for (size_t i = 0; i < size; ++i) {
+		auto& path = shared->path(i);
+		auto node = game_tree->find_child(root, path[0]);
+		if (node != nullptr && path.size() == 2) {
+			node = game_tree->find_child(node, path[1]);
+		}
+		nodes[i] = node;
+		if (node != nullptr) {
+			int node_visits;
+			double node_wins;
+			node->get_statistics(&node_visits, &node_wins);
+			visits[i] = node_visits - tree->imported_visits[i];
+			wins[i]   = node_wins   - tree->imported_wins[i];
+		}
+	}
+	shared->publish(tree_index, visits, wins);
+
+	shared->sum_of_others(tree_index, &visits, &wins);
+	for (size_t i = 0; i < size; ++i) {
+		auto& path = shared->path(i);
+		auto node = nodes[i];
+		if (node == nullptr) {
+			// Create the node if the other trees have visited it. The
+			// paths are sorted so that parents come before children.
+			auto parent = path.size() == 1 ? root : game_tree->find_child(root, path[0]);
+			if (visits[i] <= 0 || parent == nullptr ||
+			    ! game_tree->take_untried_move(parent, path.back())) {
+				continue;
+			}
+			State state = root_state;
+			for (auto& move: path) {
+				state.do_move(move);
+			}
+			node = game_tree->add_child(parent, path.back(), state);
+		}
+
+		auto delta_visits = visits[i] - tree->imported_visits[i];
+		node->add_statistics(delta_visits, wins[i] - tree->imported_wins[i]);
+		if (path.size() == 1) {
+			root->add_statistics(delta_visits, 0);
+		}
+		tree->imported_visits[i] = visits[i];
+		tree->imported_wins[i]   = wins[i];
+	}
+}
+
+// Removes the statistics imported by synchronize_shared_nodes so that
+// only the games played in this tree remain.
+template<typename State>
+void remove_imported_statistics(SharedTree<State>* tree,
+                                const SharedStatistics<State>& shared)
+{
+	auto game_tree = tree->game_tree.get();
+	auto root = game_tree->root();
+	for (size_t i = 0; i < shared.size(); ++i) {
+		auto& path = shared.path(i);
+		auto node = game_tree->find_child(root, path[0]);
+		if (node != nullptr && path.size() == 2) {
+			node = game_tree->find_child(node, path[1]);
+		}
+		if (node == nullptr) {
+			continue;
+		}
+
+		node->add_statistics(-tree->imported_visits[i], -tree->imported_wins[i]);
+		if (path.size() == 1) {
+			root->add_statistics(-tree->imported_visits[i], 0);
+		}
+		tree->imported_visits[i] = 0;
+		tree->imported_wins[i]   = 0;
+	}
+}
+
+// Pins the calling thread to the given CPU. Only supported on Linux;
+// elsewhere this does nothing.
+static void set_thread_affinity(int cpu)
+{
+	#ifdef __linux__
+	cpu_set_t cpu_set;
+	CPU_ZERO(&cpu_set);
+	CPU_SET(cpu, &cpu_set);
+	pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+	#endif
+}
+
+// One of the threads searching a shared tree.
+template<typename State>
+void search_shared_tree(const State& root_state,
+                        const ComputeOptions& options,
+                        SharedTree<State>* tree,
+                        int tree_index,
+                        SharedStatistics<State>* shared,
+                        std::mt19937_64::result_type initial_seed)
+{
+	std::mt19937_64 random_engine(initial_seed);
+
+	attest(options.max_iterations >= 0 || options.max_time >= 0);
+	if (options.max_time >= 0) {
+		#ifndef USE_OPENMP
+		throw std::runtime_error("ComputeOptions::max_time requires OpenMP.");
+		#endif
 	}
 
 	#ifdef USE_OPENMP
 	double start_time = ::omp_get_wtime();
 	#endif
 
-	// Start all jobs to compute trees.
-	vector<future<unique_ptr<Node<State>>>> root_futures;
-	ComputeOptions job_options = options;
-	job_options.verbose = false;
-	for (int t = 0; t < options.number_of_threads; ++t) {
-		auto func = [t, &root_state, &job_options] () -> std::unique_ptr<Node<State>>
+	const long long max_iterations = (long long)(options.max_iterations) * options.threads_per_tree;
+
+	while (true) {
+		State state = root_state;
+		Node<State>* node;
+		long long iteration;
+
 		{
-			return compute_tree(root_state, job_options, 1012411 * t + 12515);
-		};
+			std::lock_guard<std::mutex> lock(tree->mutex);
+			if (options.max_iterations >= 0 && tree->iterations >= max_iterations) {
+				break;
+			}
+			if (tree->game_tree->root()->visits() >= Node<State>::max_visits / 2) {
+				break;
+			}
+			iteration = ++tree->iterations;
+
+			node = select_and_expand(tree->game_tree.get(), &state, &random_engine, options);
+
+			// Virtual loss: the path is counted as a lost game until the
+			// result is known, which steers the other threads of the
+			// group to other parts of the tree.
+			for (auto n = node; n != nullptr; n = tree->game_tree->parent(n)) {
+				n->update(0, 1);
+			}
+		}
+
+		// We now play randomly until the game ends.
+		auto results = play_out(&state, options.playouts_per_leaf, &random_engine);
+
+		// The parents of a node never change, so the path can be walked
+		// without the lock.
+		for (auto n = node; n != nullptr; n = tree->game_tree->parent(n)) {
+			n->update(n->player_to_move == 1 ? results.first : results.second,
+			          options.playouts_per_leaf - 1);
+		}
+
+		if (options.sync_interval > 0 && iteration % options.sync_interval == 0) {
+			std::lock_guard<std::mutex> lock(tree->mutex);
+			synchronize_shared_nodes(root_state, tree, tree_index, shared);
+		}
+
+		#ifdef USE_OPENMP
+		if (options.max_time >= 0 && ::omp_get_wtime() - start_time >= options.max_time) {
+			break;
+		}
+		#endif
+	}
+}
 
-		root_futures.push_back(std::async(std::launch::async, func));
+// Computes one tree per group of options.threads_per_tree threads. The
+// returned trees only contain the games played in themselves.
+template<typename State>
+std::vector<std::unique_ptr<Tree<State>>> compute_shared_trees(const State& root_state,
+                                                               const ComputeOptions& options,
+                                                               int first_thread)
+{
+	using namespace std;
+
+	check(options.threads_per_tree >= 1,
+	      "threads_per_tree must be at least 1.");
+	check(options.number_of_threads % options.threads_per_tree == 0,
+	      "number_of_threads must be a multiple of threads_per_tree.");
+	const int number_of_trees = options.number_of_threads / options.threads_per_tree;
+
+	// The shared statistics are only needed if the trees synchronize.
+	SharedStatistics<State> shared(root_state, options.sync_depth,
+	                               options.sync_interval > 0 ? number_of_trees : 0);
+	vector<unique_ptr<SharedTree<State>>> trees;
+	for (int g = 0; g < number_of_trees; ++g) {
+		trees.emplace_back(new SharedTree<State>(root_state, shared.size()));
 	}
 
-	// Collect the results.
-	vector<unique_ptr<Node<State>>> roots;
+	vector<future<void>> threads;
 	for (int t = 0; t < options.number_of_threads; ++t) {
-		roots.push_back(std::move(root_futures[t].get()));
+		int g = t / options.threads_per_tree;
+		auto tree = trees[g].get();
+		auto func = [t, g, tree, first_thread, &shared, &root_state, &options] ()
+		{
+			if ( ! options.cpu_affinity.empty()) {
+				set_thread_affinity(options.cpu_affinity[t % options.cpu_affinity.size()]);
+			}
+			search_shared_tree(root_state, options, tree, g, &shared, 1012411 * (first_thread + t) + 12515);
+		};
+		threads.push_back(std::async(std::launch::async, func));
+	}
+	for (auto& thread: threads) {
+		thread.wait();
+	}
+	for (auto& thread: threads) {
+		thread.get();
 	}
 
-	// Merge the children of all root nodes.
-	map<typename State::Move, int> visits;
-	map<typename State::Move, double> wins;
-	long long games_played = 0;
-	for (int t = 0; t < options.number_of_threads; ++t) {
-		auto root = roots[t].get();
-		games_played += root->visits;
-		for (auto child = root->children.cbegin(); child != root->children.cend(); ++child) {
-			visits[(*child)->move] += (*child)->visits;
-			wins[(*child)->move]   += (*child)->wins;
-		}
+	vector<unique_ptr<Tree<State>>> game_trees;
+	for (auto& tree: trees) {
+		remove_imported_statistics(tree.get(), shared);
+		game_trees.push_back(std::move(tree->game_tree));
 	}
+	return game_trees;
+}
+
+// Adds the statistics of the children of the root to statistics and
+// returns the number of games played in the tree.
+template<typename State>
+long long add_root_statistics(const Tree<State>& tree,
+                              RootStatistics<typename State::Move>* statistics)
+{
+	auto root = tree.root();
+	for (auto child: tree.children(root)) {
+		auto& item = (*statistics)[child->move];
+		int visits;
+		double wins;
+		child->get_statistics(&visits, &wins);
+		item.first  += visits;
+		item.second += wins;
+	}
+	return root->visits();
+}
+
+template<typename Move>
+Move best_move_from_statistics(const RootStatistics<Move>& statistics,
+                               long long games_played,
+                               bool verbose)
+{
+	using namespace std;
 
 	// Find the node with the highest score.
 	double best_score = -1;
-	typename State::Move best_move = typename State::Move();
-	for (auto itr: visits) {
+	Move best_move = Move();
+	double best_visits = 0;
+	double best_wins = 0;
+	for (auto& itr: statistics) {
 		auto move = itr.first;
-		double v = itr.second;
-		double w = wins[move];
+		double v = double(itr.second.first);
+		double w = itr.second.second;
 		// Expected success rate assuming a uniform prior (Beta(1, 1)).
 		// https://en.wikipedia.org/wiki/Beta_distribution
 		double expected_success_rate = (w + 1) / (v + 2);
 		if (expected_success_rate > best_score) {
 			best_move = move;
 			best_score = expected_success_rate;
+			best_visits = v;
+			best_wins = w;
 		}
 
-		if (options.verbose) {
+		if (verbose) {
 			cerr << "Move: " << itr.first
 			     << " (" << setw(2) << right << int(100.0 * v / double(games_played) + 0.5) << "% visits)"
 			     << " (" << setw(2) << right << int(100.0 * w / v + 0.5)    << "% wins)" << endl;
 		}
 	}
 
-	if (options.verbose) {
-		auto best_wins = wins[best_move];
-		auto best_visits = visits[best_move];
+	if (verbose) {
 		cerr << "----" << endl;
 		cerr << "Best: " << best_move
 		     << " (" << 100.0 * best_visits / double(games_played) << "% visits)"
 		     << " (" << 100.0 * best_wins / best_visits << "% wins)" << endl;
 	}
 
+	return best_move;
+}
+
+template<typename State>
+typename State::Move best_move_from_roots(const vector<std::unique_ptr<Tree<State>>>& trees,
+                                          bool verbose,
+                                          long long* games_played_out = nullptr)
+{
+	// Merge the children of all root nodes.
+	RootStatistics<typename State::Move> statistics;
+	long long games_played = 0;
+	for (auto& tree: trees) {
+		games_played += add_root_statistics(*tree, &statistics);
+	}
+
+	if (games_played_out != nullptr) {
+		*games_played_out = games_played;
+	}
+	return best_move_from_statistics(statistics, games_played, verbose);
+}
+
+// A move of a principal variation with the statistics of its nodes.
+template<typename Move>
+struct VariationStep
+{
+	Move move;
+	long long visits;
+	double wins;
+};
+
+// The expected line of play: starting at the roots, the move whose
+// nodes have the most visits in all trees together is followed, as
+// long as any tree has children and for at most max_depth moves.
+// The first move may differ from the one chosen by compute_move,
+// which also takes the wins into account.
+template<typename State>
+std::vector<VariationStep<typename State::Move>>
+	principal_variation(const vector<std::unique_ptr<Tree<State>>>& trees,
+	                    int max_depth = 1000000)
+{
+	typedef typename State::Move Move;
+
+	std::vector<VariationStep<Move>> variation;
+	std::vector<std::pair<const Tree<State>*, const Node<State>*>> nodes;
+	for (auto& tree: trees) {
+		nodes.push_back(std::make_pair(tree.get(), tree->root()));
+	}
+
+	while (int(variation.size()) < max_depth) {
+		RootStatistics<Move> statistics;
+		for (auto& item: nodes) {
+			for (auto child: item.first->children(item.second)) {
+				int visits;
+				double wins;
+				child->get_statistics(&visits, &wins);
+				auto& merged = statistics[child->move];
+				merged.first  += visits;
+				merged.second += wins;
+			}
+		}
+		if (statistics.empty()) {
+			break;
+		}
+
+		auto best = statistics.begin();
+		for (auto itr = statistics.begin(); itr != statistics.end(); ++itr) {
+			if (itr->second.first > best->second.first) {
+				best = itr;
+			}
+		}
+		VariationStep<Move> step = {best->first, best->second.first, best->second.second};
+		variation.push_back(step);
+
+		// Continue in the trees that have the move.
+		std::vector<std::pair<const Tree<State>*, const Node<State>*>> next_nodes;
+		for (auto& item: nodes) {
+			auto child = item.first->find_child(item.second, step.move);
+			if (child != nullptr) {
+				next_nodes.push_back(std::make_pair(item.first, child));
+			}
+		}
+		nodes.swap(next_nodes);
+	}
+	return variation;
+}
+
+// Computes the trees of a parallel search with options.number_of_threads
+// threads. The threads are numbered from first_thread, which determines
+// their random seeds.
+template<typename State>
+std::vector<std::unique_ptr<Tree<State>>> compute_trees(const State& root_state,
+                                                        const ComputeOptions& options,
+                                                        int first_thread = 0)
+{
+	using namespace std;
+
+	if (options.threads_per_tree > 1 || options.sync_interval > 0) {
+		return compute_shared_trees(root_state, options, first_thread);
+	}
+
+	// Start all jobs to compute trees.
+	vector<future<unique_ptr<Tree<State>>>> tree_futures;
+	for (int t = 0; t < options.number_of_threads; ++t) {
+		auto func = [t, first_thread, &root_state, &options] () -> std::unique_ptr<Tree<State>>
+		{
+			if ( ! options.cpu_affinity.empty()) {
+				set_thread_affinity(options.cpu_affinity[t % options.cpu_affinity.size()]);
+			}
+			return compute_tree(root_state, options, 1012411 * (first_thread + t) + 12515);
+		};
+
+		tree_futures.push_back(std::async(std::launch::async, func));
+	}
+
+	// Collect the results.
+	vector<unique_ptr<Tree<State>>> trees;
+	for (int t = 0; t < options.number_of_threads; ++t) {
+		trees.push_back(std::move(tree_futures[t].get()));
+	}
+	return trees;
+}
+
+template<typename State>
+typename State::Move compute_move(const State root_state,
+                                  const ComputeOptions options)
+{
+	using namespace std;
+
+	// Will support more players later.
+	attest(root_state.player_to_move == 1 || root_state.player_to_move == 2);
+
+	auto moves = root_state.get_moves();
+	attest(moves.size() > 0);
+	if (moves.size() == 1) {
+		return moves[0];
+	}
+
+	#ifdef USE_OPENMP
+	double start_time = ::omp_get_wtime();
+	#endif
+
+	ComputeOptions job_options = options;
+	job_options.verbose = false;
+	auto trees = compute_trees(root_state, job_options);
+
+	long long games_played = 0;
+	auto best_move = best_move_from_roots(trees, options.verbose, &games_played);
+
+	if (options.verbose) {
+		cerr << "Principal variation:";
+		for (auto& step: principal_variation(trees, 10)) {
+			cerr << " " << step.move << " (" << step.visits << ")";
+		}
+		cerr << endl;
+	}
+
 	#ifdef USE_OPENMP
 	if (options.verbose) {
 		double time = ::omp_get_wtime();
@@ -462,6 +1695,377 @@ typename State::Move compute_move(const State root_state,
 	return best_move;
 }
 
+// A snapshot of a running search.
+template<typename Move>
+struct SearchProgress
+{
+	long long games_played;
+	double elapsed_time;      // Seconds since the search started.
+	double games_per_second;
+	size_t tree_size;         // Nodes in all trees.
+	RootStatistics<Move> root_statistics;
+	std::vector<VariationStep<Move>> principal_variation;
+	bool finished;            // True for the last report of a search.
+};
+
+//
+// A search running in the background. start returns at once; the
+// statistics found so far can be polled while the threads work, and
+// stop ends the search within one iteration per thread. Every thread
+// has its own tree with the same seed as in compute_move (plain root
+// parallelization).
+//
+// With both max_iterations and max_time negative, the search runs
+// until stop is called.
+//
+// The progress callback is called by the first search thread, which
+// does not search in the meantime, and finally by wait.
+//
+template<typename State>
+class SearchHandle
+{
+public:
+	typedef typename State::Move Move;
+	typedef std::function<void(const SearchProgress<Move>&)> ProgressCallback;
+
+	SearchHandle() :
+		running(false),
+		stop_flag(false)
+	{ }
+
+	~SearchHandle()
+	{
+		stop();
+		for (auto& thread: threads) {
+			thread.wait();
+		}
+	}
+
+	// Starts a new search. A search already running is stopped and its
+	// result discarded.
+	void start(const State& root_state,
+	           const ComputeOptions& options_,
+	           ProgressCallback progress_callback_ = ProgressCallback())
+	{
+		stop_threads();
+		trees.clear();
+		launch(root_state, options_, progress_callback_);
+	}
+
+	// Starts a new search from the position after moves_played, played
+	// from the root of the previous search. The parts of the previous
+	// trees below the new root are kept, so their games count towards
+	// the new search. Trees that never reached the new root start over.
+	void start_after_moves(const std::vector<Move>& moves_played,
+	                       const State& root_state,
+	                       const ComputeOptions& options_,
+	                       ProgressCallback progress_callback_ = ProgressCallback())
+	{
+		stop_threads();
+		for (auto& tree: trees) {
+			const Node<State>* node = tree->root();
+			for (auto& move: moves_played) {
+				node = tree->find_child(node, move);
+				if (node == nullptr) {
+					break;
+				}
+			}
+			if (node != nullptr && node->player_to_move == root_state.player_to_move) {
+				tree = tree->subtree(node, root_state);
+			}
+			else {
+				tree.reset(new Tree<State>(root_state));
+			}
+		}
+		launch(root_state, options_, progress_callback_);
+	}
+
+	// Asks the threads to stop and returns at once.
+	void stop()
+	{
+		stop_flag = true;
+	}
+
+	bool is_finished() const
+	{
+		for (auto& thread: threads) {
+			if (thread.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// The merged statistics of the root children so far.
+	RootStatistics<Move> get_root_statistics(long long* games_played = nullptr) const
+	{
+		RootStatistics<Move> statistics;
+		long long games = 0;
+		for (auto& tree: trees) {
+			games += add_root_statistics(*tree, &statistics);
+		}
+		if (games_played != nullptr) {
+			*games_played = games;
+		}
+		return statistics;
+	}
+
+	// The best move according to the statistics so far.
+	Move get_best_move() const
+	{
+		return best_move(false);
+	}
+
+	std::vector<VariationStep<Move>> get_principal_variation(int max_depth = 1000000) const
+	{
+		return principal_variation(trees, max_depth);
+	}
+
+	SearchProgress<Move> get_progress() const
+	{
+		SearchProgress<Move> progress;
+		progress.root_statistics = get_root_statistics(&progress.games_played);
+		progress.elapsed_time = std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - start_time).count();
+		progress.games_per_second = progress.elapsed_time > 0 ?
+			double(progress.games_played) / progress.elapsed_time : 0;
+		progress.tree_size = 0;
+		for (auto& tree: trees) {
+			progress.tree_size += tree->size();
+		}
+		progress.principal_variation = principal_variation(trees);
+		progress.finished = false;
+		return progress;
+	}
+
+	// Waits for the search to end and returns the best move. Exceptions
+	// thrown by the threads are rethrown here. Throws
+	// std::invalid_argument if no search has been started.
+	Move wait()
+	{
+		for (auto& thread: threads) {
+			thread.wait();
+		}
+		for (auto& thread: threads) {
+			thread.get();
+		}
+		threads.clear();
+		if (running) {
+			running = false;
+			report(true);
+		}
+		return best_move(options.verbose);
+	}
+
+private:
+	void stop_threads()
+	{
+		stop();
+		for (auto& thread: threads) {
+			thread.wait();
+		}
+		threads.clear();
+	}
+
+	// Starts the threads on the trees, creating new trees as needed.
+	void launch(const State& root_state,
+	            const ComputeOptions& options_,
+	            ProgressCallback progress_callback_)
+	{
+		check(options_.threads_per_tree == 1 && options_.sync_interval == 0,
+		      "SearchHandle only supports plain root parallelization.");
+		attest(root_state.player_to_move == 1 || root_state.player_to_move == 2);
+		options = options_;
+		progress_callback = progress_callback_;
+		moves = root_state.get_moves();
+		attest(moves.size() > 0);
+		stop_flag = false;
+		running = true;
+		start_time = std::chrono::steady_clock::now();
+		if (moves.size() == 1) {
+			return;
+		}
+
+		report_progress = [this] () { this->report(false); };
+
+		ComputeOptions job_options = options;
+		job_options.verbose = false;
+		// All trees exist before the first thread may report on them.
+		trees.resize(std::min(trees.size(), size_t(options.number_of_threads)));
+		while (int(trees.size()) < options.number_of_threads) {
+			trees.emplace_back(new Tree<State>(root_state));
+		}
+		for (int t = 0; t < options.number_of_threads; ++t) {
+			auto tree = trees[t].get();
+			auto stop = &stop_flag;
+			auto report = t == 0 && progress_callback ? &report_progress : nullptr;
+			auto func = [t, tree, stop, report, root_state, job_options] ()
+			{
+				if ( ! job_options.cpu_affinity.empty()) {
+					set_thread_affinity(job_options.cpu_affinity[t % job_options.cpu_affinity.size()]);
+				}
+				search_tree(tree, root_state, job_options, 1012411 * t + 12515, stop, report);
+			};
+			threads.push_back(std::async(std::launch::async, func));
+		}
+	}
+
+	void report(bool finished) const
+	{
+		if (progress_callback) {
+			auto progress = get_progress();
+			progress.finished = finished;
+			progress_callback(progress);
+		}
+	}
+
+	Move best_move(bool verbose) const
+	{
+		check( ! moves.empty(), "SearchHandle: no search has been started.");
+		long long games_played = 0;
+		auto statistics = get_root_statistics(&games_played);
+		if (statistics.empty()) {
+			return moves.at(0);
+		}
+		return best_move_from_statistics(statistics, games_played, verbose);
+	}
+
+	SearchHandle(const SearchHandle&);
+	SearchHandle& operator = (const SearchHandle&);
+
+	ComputeOptions options;
+	ProgressCallback progress_callback;
+	std::function<void()> report_progress;
+	std::chrono::steady_clock::time_point start_time;
+	std::vector<Move> moves;
+	bool running;
+	std::atomic<bool> stop_flag;
+	std::vector<std::unique_ptr<Tree<State>>> trees;
+	std::vector<std::future<void>> threads;
+};
+
+// Searches every position with the same trees (and seeds) that
+// compute_move would use and returns the merged statistics of the root
+// children of each position. Each tree is one task in a shared pool of
+// options.number_of_threads threads. All positions must have moves.
+template<typename State>
+std::vector<RootStatistics<typename State::Move>>
+	compute_root_statistics(const std::vector<State>& root_states,
+	                        const ComputeOptions& options,
+	                        std::vector<long long>* games_played = nullptr)
+{
+	using namespace std;
+
+	const int trees_per_position = options.number_of_threads;
+	ComputeOptions job_options = options;
+	job_options.verbose = false;
+
+	// Every task merges the root of its tree into its own slot and frees
+	// the tree, so at most one tree per thread is alive at any time.
+	typedef RootStatistics<typename State::Move> Statistics;
+	vector<vector<Statistics>> tree_statistics(root_states.size(), vector<Statistics>(trees_per_position));
+	vector<vector<long long>> tree_games_played(root_states.size(), vector<long long>(trees_per_position, 0));
+
+	WorkStealingPool pool(options.number_of_threads);
+	for (size_t p = 0; p < root_states.size(); ++p) {
+		auto& root_state = root_states[p];
+		attest(root_state.player_to_move == 1 || root_state.player_to_move == 2);
+
+		for (int t = 0; t < trees_per_position; ++t) {
+			auto slot = &tree_statistics[p][t];
+			auto slot_games_played = &tree_games_played[p][t];
+			auto func = [t, slot, slot_games_played, &root_state, &job_options] ()
+			{
+				auto tree = compute_tree(root_state, job_options, 1012411 * t + 12515);
+				*slot_games_played = add_root_statistics(*tree, slot);
+			};
+			pool.add(func);
+		}
+	}
+	pool.run();
+
+	vector<Statistics> statistics(root_states.size());
+	if (games_played != nullptr) {
+		games_played->assign(root_states.size(), 0);
+	}
+	for (size_t p = 0; p < root_states.size(); ++p) {
+		long long position_games_played = 0;
+		for (int t = 0; t < trees_per_position; ++t) {
+			for (auto& child: tree_statistics[p][t]) {
+				auto& merged = statistics[p][child.first];
+				merged.first += child.second.first;
+				merged.second += child.second.second;
+			}
+			position_games_played += tree_games_played[p][t];
+		}
+		if (games_played != nullptr) {
+			(*games_played)[p] = position_games_played;
+		}
+	}
+	return statistics;
+}
+
+template<typename State>
+std::vector<typename State::Move> compute_moves(const std::vector<State>& root_states,
+                                                const ComputeOptions options)
+{
+	using namespace std;
+
+	#ifdef USE_OPENMP
+	double start_time = ::omp_get_wtime();
+	#endif
+
+	vector<typename State::Move> best_moves(root_states.size(), typename State::Move());
+	vector<size_t> searched_positions;
+	vector<State> searched_states;
+	for (size_t p = 0; p < root_states.size(); ++p) {
+		auto moves = root_states[p].get_moves();
+		attest(moves.size() > 0);
+		if (moves.size() == 1) {
+			best_moves[p] = moves[0];
+		}
+		else {
+			searched_positions.push_back(p);
+			searched_states.push_back(root_states[p]);
+		}
+	}
+
+	vector<long long> games_played;
+	auto statistics = compute_root_statistics(searched_states, options, &games_played);
+	for (size_t i = 0; i < searched_positions.size(); ++i) {
+		best_moves[searched_positions[i]] = best_move_from_statistics(statistics[i], games_played[i], false);
+	}
+
+	#ifdef USE_OPENMP
+	if (options.verbose) {
+		double time = ::omp_get_wtime();
+		long long total_games_played = 0;
+		for (auto games: games_played) {
+			total_games_played += games;
+		}
+		std::cerr << root_states.size() << " positions (" << total_games_played << " games) searched in "
+		          << double(time - start_time) << " s. "
+		          << "(" << double(root_states.size()) / (time - start_time) << " positions / second, "
+		          << options.number_of_threads << " parallel jobs)." << endl;
+	}
+	#endif
+
+	return best_moves;
+}
+
+// 64-bit FNV-1a hash of a block of memory. A previous hash can be
+// continued by passing it as the last argument. Meant for get_hash.
+inline std::uint64_t hash_bytes(const void* data, size_t size,
+                                std::uint64_t hash = 14695981039346656037ULL)
+{
+	auto bytes = static_cast<const unsigned char*>(data);
+	for (size_t i = 0; i < size; ++i) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
 /////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////
 
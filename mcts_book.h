@@ -0,0 +1,560 @@
+#ifndef MCTS_BOOK_HEADER_PETTER
+#define MCTS_BOOK_HEADER_PETTER
+//
+// Opening books for the Monte Carlo tree search.
+//
+// A search tree can be written to a compact binary file with
+// write_book_tree. A BookTree maps such a file read-only into memory
+// (on POSIX systems; elsewhere the file is read into a buffer) and
+// its nodes are used directly from the mapping, without parsing or
+// allocating. compute_move_with_book answers instantly from a book
+// node with enough games and otherwise adds the book statistics to
+// those of a normal search.
+//
+// A PositionBook is a table from position hashes (State::get_hash) to
+// the statistics of the moves in that position, as written by the
+// opening_book tool. Positions found in it need no search at all.
+//
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <mcts.h>
+
+namespace MCTS
+{
+//
+// A read-only view of a whole file, memory-mapped if possible.
+//
+class MappedFile
+{
+public:
+	MappedFile(const std::string& file_name) :
+		data_(nullptr),
+		size_(0)
+	{
+		#ifndef _WIN32
+		int fd = ::open(file_name.c_str(), O_RDONLY);
+		if (fd < 0) {
+			throw std::runtime_error("Could not open " + file_name + ".");
+		}
+		struct stat file_status;
+		if (::fstat(fd, &file_status) != 0) {
+			::close(fd);
+			throw std::runtime_error("Could not read the size of " + file_name + ".");
+		}
+		size_ = size_t(file_status.st_size);
+		if (size_ > 0) {
+			void* mapping = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+			if (mapping == MAP_FAILED) {
+				::close(fd);
+				throw std::runtime_error("Could not map " + file_name + ".");
+			}
+			data_ = static_cast<const char*>(mapping);
+		}
+		::close(fd);
+		#else
+		std::ifstream fin(file_name, std::ios::binary);
+		if ( ! fin) {
+			throw std::runtime_error("Could not open " + file_name + ".");
+		}
+		buffer.assign(std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>());
+		data_ = buffer.data();
+		size_ = buffer.size();
+		#endif
+	}
+
+	~MappedFile()
+	{
+		#ifndef _WIN32
+		if (data_ != nullptr) {
+			::munmap(const_cast<char*>(data_), size_);
+		}
+		#endif
+	}
+
+	const char* data() const
+	{
+		return data_;
+	}
+
+	size_t size() const
+	{
+		return size_;
+	}
+
+private:
+	const char* data_;
+	size_t size_;
+	#ifdef _WIN32
+	std::vector<char> buffer;
+	#endif
+
+	MappedFile(const MappedFile&);
+	MappedFile& operator = (const MappedFile&);
+};
+
+namespace book
+{
+static const char tree_magic[8] = {'M', 'C', 'T', 'S', 'T', 'R', 'E', 'E'};
+static const std::uint32_t tree_version = 1;
+
+struct TreeHeader
+{
+	char magic[8];
+	std::uint32_t version;
+	std::uint32_t record_size;
+	std::uint64_t number_of_nodes;
+};
+
+// The nodes are stored in breadth-first order, so the children of a
+// node are consecutive records and the root is the first record.
+template<typename Move>
+struct TreeRecord
+{
+	Move move;
+	std::int32_t player_to_move;
+	std::uint32_t first_child;
+	std::uint32_t number_of_children;
+	std::uint32_t visits;
+	double wins;
+};
+
+static const char position_magic[8] = {'M', 'C', 'T', 'S', 'P', 'O', 'S', 'B'};
+static const std::uint32_t position_version = 1;
+
+struct PositionHeader
+{
+	char magic[8];
+	std::uint32_t version;
+	std::uint32_t record_size;
+	std::uint64_t number_of_records;
+};
+
+// One record per move and position, sorted by hash.
+template<typename Move>
+struct PositionRecord
+{
+	std::uint64_t hash;
+	Move move;
+	std::uint32_t visits;
+	double wins;
+};
+
+// In a journal, the records of each position are preceded by a block
+// header, so that a block cut short by a crash can be detected.
+struct JournalBlock
+{
+	std::uint64_t hash;
+	std::uint32_t number_of_moves;
+	std::uint32_t unused;
+};
+}
+
+// Writes the tree to a binary file. Nodes with fewer than min_visits
+// visits, and their subtrees, are left out.
+template<typename State>
+void write_book_tree(const Tree<State>& tree, const std::string& file_name, int min_visits = 1)
+{
+	typedef typename State::Move Move;
+	static_assert(std::is_pod<Move>::value, "Moves are stored as raw bytes.");
+
+	// Breadth-first numbering of the nodes that are kept.
+	std::vector<const Node<State>*> nodes(1, tree.root());
+	std::vector<book::TreeRecord<Move>> records;
+	for (size_t i = 0; i < nodes.size(); ++i) {
+		auto node = nodes[i];
+		book::TreeRecord<Move> record;
+		std::memset(&record, 0, sizeof(record));
+		record.move = node->move;
+		record.player_to_move = node->player_to_move;
+		record.first_child = std::uint32_t(nodes.size());
+		int visits;
+		node->get_statistics(&visits, &record.wins);
+		record.visits = std::uint32_t(visits);
+		for (auto child: tree.children(node)) {
+			if (child->visits() >= min_visits) {
+				nodes.push_back(child);
+				record.number_of_children++;
+			}
+		}
+		records.push_back(record);
+	}
+
+	book::TreeHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, book::tree_magic, sizeof(header.magic));
+	header.version = book::tree_version;
+	header.record_size = sizeof(book::TreeRecord<Move>);
+	header.number_of_nodes = records.size();
+
+	std::ofstream fout(file_name, std::ios::binary);
+	fout.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	fout.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(records[0]));
+	if ( ! fout) {
+		throw std::runtime_error("Could not write " + file_name + ".");
+	}
+}
+
+//
+// A node in a memory-mapped book tree. Cheap to copy.
+//
+template<typename Move>
+class BookNode
+{
+public:
+	BookNode() :
+		records(nullptr),
+		index(0)
+	{ }
+
+	BookNode(const book::TreeRecord<Move>* records_, std::uint32_t index_) :
+		records(records_),
+		index(index_)
+	{ }
+
+	// False for the node returned when a child is not in the book.
+	bool is_valid() const
+	{
+		return records != nullptr;
+	}
+
+	Move move() const
+	{
+		return record().move;
+	}
+
+	int player_to_move() const
+	{
+		return record().player_to_move;
+	}
+
+	long long visits() const
+	{
+		return record().visits;
+	}
+
+	double wins() const
+	{
+		return record().wins;
+	}
+
+	size_t number_of_children() const
+	{
+		return record().number_of_children;
+	}
+
+	BookNode child(size_t i) const
+	{
+		attest(i < number_of_children());
+		return BookNode(records, record().first_child + std::uint32_t(i));
+	}
+
+	// Returns an invalid node if the move is not in the book.
+	BookNode find_child(const Move& move) const
+	{
+		for (size_t i = 0; i < number_of_children(); ++i) {
+			if (records[record().first_child + i].move == move) {
+				return child(i);
+			}
+		}
+		return BookNode();
+	}
+
+	// Adds the statistics of the children to statistics.
+	void add_root_statistics(RootStatistics<Move>* statistics) const
+	{
+		for (size_t i = 0; i < number_of_children(); ++i) {
+			auto& child = records[record().first_child + i];
+			auto& item = (*statistics)[child.move];
+			item.first  += child.visits;
+			item.second += child.wins;
+		}
+	}
+
+private:
+	const book::TreeRecord<Move>& record() const
+	{
+		attest(is_valid());
+		return records[index];
+	}
+
+	const book::TreeRecord<Move>* records;
+	std::uint32_t index;
+};
+
+//
+// A book tree file mapped into memory.
+//
+template<typename Move>
+class BookTree
+{
+public:
+	BookTree(const std::string& file_name) :
+		file(file_name)
+	{
+		book::TreeHeader header;
+		if (file.size() < sizeof(header)) {
+			throw std::runtime_error(file_name + " is not a book tree.");
+		}
+		std::memcpy(&header, file.data(), sizeof(header));
+		if (std::memcmp(header.magic, book::tree_magic, sizeof(header.magic)) != 0 ||
+		    header.version != book::tree_version ||
+		    header.record_size != sizeof(book::TreeRecord<Move>) ||
+		    header.number_of_nodes == 0 ||
+		    file.size() != sizeof(header) + header.number_of_nodes * sizeof(book::TreeRecord<Move>)) {
+			throw std::runtime_error(file_name + " is not a book tree for this game.");
+		}
+
+		records = reinterpret_cast<const book::TreeRecord<Move>*>(file.data() + sizeof(header));
+		number_of_nodes = size_t(header.number_of_nodes);
+		for (size_t i = 0; i < number_of_nodes; ++i) {
+			if (records[i].number_of_children > 0 &&
+			    size_t(records[i].first_child) + records[i].number_of_children > number_of_nodes) {
+				throw std::runtime_error(file_name + " is corrupt.");
+			}
+		}
+	}
+
+	BookNode<Move> root() const
+	{
+		return BookNode<Move>(records, 0);
+	}
+
+	size_t size() const
+	{
+		return number_of_nodes;
+	}
+
+private:
+	MappedFile file;
+	const book::TreeRecord<Move>* records;
+	size_t number_of_nodes;
+};
+
+// The move statistics of every position in a position book.
+template<typename Move>
+using PositionStatistics = std::map<std::uint64_t, RootStatistics<Move>>;
+
+// Writes a position book, sorted by hash.
+template<typename Move>
+void write_position_book(const PositionStatistics<Move>& positions, const std::string& file_name)
+{
+	static_assert(std::is_pod<Move>::value, "Moves are stored as raw bytes.");
+
+	std::vector<book::PositionRecord<Move>> records;
+	for (auto& position: positions) {
+		for (auto& item: position.second) {
+			book::PositionRecord<Move> record;
+			std::memset(&record, 0, sizeof(record));
+			record.hash = position.first;
+			record.move = item.first;
+			record.visits = std::uint32_t(item.second.first);
+			record.wins = item.second.second;
+			records.push_back(record);
+		}
+	}
+
+	book::PositionHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, book::position_magic, sizeof(header.magic));
+	header.version = book::position_version;
+	header.record_size = sizeof(book::PositionRecord<Move>);
+	header.number_of_records = records.size();
+
+	std::ofstream fout(file_name, std::ios::binary);
+	fout.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	fout.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(records[0]));
+	if ( ! fout) {
+		throw std::runtime_error("Could not write " + file_name + ".");
+	}
+}
+
+// Appends the statistics of one position to a journal file, which is
+// created if needed. The data is flushed before returning.
+template<typename Move>
+void append_to_position_journal(const std::string& file_name,
+                                std::uint64_t hash,
+                                const RootStatistics<Move>& statistics)
+{
+	static_assert(std::is_pod<Move>::value, "Moves are stored as raw bytes.");
+
+	book::JournalBlock block;
+	std::memset(&block, 0, sizeof(block));
+	block.hash = hash;
+	block.number_of_moves = std::uint32_t(statistics.size());
+
+	std::vector<book::PositionRecord<Move>> records;
+	for (auto& item: statistics) {
+		book::PositionRecord<Move> record;
+		std::memset(&record, 0, sizeof(record));
+		record.hash = hash;
+		record.move = item.first;
+		record.visits = std::uint32_t(item.second.first);
+		record.wins = item.second.second;
+		records.push_back(record);
+	}
+
+	std::ofstream fout(file_name, std::ios::binary | std::ios::app);
+	fout.write(reinterpret_cast<const char*>(&block), sizeof(block));
+	fout.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(records[0]));
+	fout.flush();
+	if ( ! fout) {
+		throw std::runtime_error("Could not write " + file_name + ".");
+	}
+}
+
+// Reads all complete positions in a journal file. A missing file is
+// treated as an empty journal, and the journal ends at the first block
+// that is cut short or claims more moves than the rest of the file holds.
+template<typename Move>
+void read_position_journal(const std::string& file_name, PositionStatistics<Move>* positions)
+{
+	std::ifstream fin(file_name, std::ios::binary);
+	fin.seekg(0, std::ios::end);
+	const std::streamoff file_size = fin.tellg();
+	fin.seekg(0, std::ios::beg);
+
+	book::JournalBlock block;
+	while (fin.read(reinterpret_cast<char*>(&block), sizeof(block))) {
+		const std::streamoff remaining = file_size - fin.tellg();
+		if (std::streamoff(block.number_of_moves) > remaining / std::streamoff(sizeof(book::PositionRecord<Move>))) {
+			break;
+		}
+		std::vector<book::PositionRecord<Move>> records(block.number_of_moves);
+		if ( ! fin.read(reinterpret_cast<char*>(records.data()), records.size() * sizeof(records[0]))) {
+			// Cut short; the position will be searched again.
+			break;
+		}
+
+		auto& statistics = (*positions)[block.hash];
+		statistics.clear();
+		for (auto& record: records) {
+			statistics[record.move] = std::make_pair((long long)(record.visits), record.wins);
+		}
+	}
+}
+
+//
+// A position book file mapped into memory.
+//
+template<typename Move>
+class PositionBook
+{
+public:
+	PositionBook(const std::string& file_name) :
+		file(file_name)
+	{
+		book::PositionHeader header;
+		if (file.size() < sizeof(header)) {
+			throw std::runtime_error(file_name + " is not a position book.");
+		}
+		std::memcpy(&header, file.data(), sizeof(header));
+		if (std::memcmp(header.magic, book::position_magic, sizeof(header.magic)) != 0 ||
+		    header.version != book::position_version ||
+		    header.record_size != sizeof(book::PositionRecord<Move>) ||
+		    file.size() != sizeof(header) + header.number_of_records * sizeof(book::PositionRecord<Move>)) {
+			throw std::runtime_error(file_name + " is not a position book for this game.");
+		}
+
+		records = reinterpret_cast<const book::PositionRecord<Move>*>(file.data() + sizeof(header));
+		number_of_records = size_t(header.number_of_records);
+	}
+
+	// Adds the statistics of the moves in the position to statistics.
+	// Returns false if the position is not in the book.
+	bool find(std::uint64_t hash, RootStatistics<Move>* statistics, long long* games_played) const
+	{
+		auto end = records + number_of_records;
+		auto first = std::lower_bound(records, end, hash,
+			[](const book::PositionRecord<Move>& record, std::uint64_t key) { return key > record.hash; });
+		if (first == end || first->hash != hash) {
+			return false;
+		}
+		for (auto record = first; record != end && hash == record->hash; ++record) {
+			auto& item = (*statistics)[record->move];
+			item.first  += record->visits;
+			item.second += record->wins;
+			*games_played += record->visits;
+		}
+		return true;
+	}
+
+	size_t size() const
+	{
+		return number_of_records;
+	}
+
+private:
+	MappedFile file;
+	const book::PositionRecord<Move>* records;
+	size_t number_of_records;
+};
+
+// Returns the best move according to the position book, or searches
+// with compute_move if the position is not in it.
+template<typename State>
+typename State::Move compute_move_with_book(const State root_state,
+                                            const PositionBook<typename State::Move>& book,
+                                            const ComputeOptions options = ComputeOptions())
+{
+	RootStatistics<typename State::Move> statistics;
+	long long games_played = 0;
+	if (book.find(root_state.get_hash(), &statistics, &games_played)) {
+		return best_move_from_statistics(statistics, games_played, options.verbose);
+	}
+	return compute_move(root_state, options);
+}
+
+// Computes the best move for a position in the book. If the book node
+// has at least min_book_visits games, the move is chosen from the book
+// alone. Otherwise a normal search is made and the book statistics of
+// the root children are added to those of the search.
+template<typename State>
+typename State::Move compute_move_with_book(const State root_state,
+                                            const BookNode<typename State::Move>& book_node,
+                                            long long min_book_visits,
+                                            const ComputeOptions options = ComputeOptions())
+{
+	attest(book_node.is_valid());
+	attest(book_node.player_to_move() == root_state.player_to_move);
+
+	RootStatistics<typename State::Move> statistics;
+	book_node.add_root_statistics(&statistics);
+	long long games_played = book_node.visits();
+
+	if (games_played < min_book_visits || statistics.empty()) {
+		auto moves = root_state.get_moves();
+		attest(moves.size() > 0);
+		if (moves.size() == 1) {
+			return moves[0];
+		}
+
+		ComputeOptions job_options = options;
+		job_options.verbose = false;
+		for (auto& tree: compute_trees(root_state, job_options)) {
+			games_played += add_root_statistics(*tree, &statistics);
+		}
+	}
+
+	return best_move_from_statistics(statistics, games_played, options.verbose);
+}
+
+}
+
+#endif
@@ -0,0 +1,275 @@
+#ifndef MCTS_DISTRIBUTED_HEADER_PETTER
+#define MCTS_DISTRIBUTED_HEADER_PETTER
+//
+// Multi-process root parallelization for POSIX systems.
+//
+// The coordinator starts a number of worker processes. Every worker
+// computes options.number_of_threads trees with compute_trees and sends
+// the statistics of the root children back over a socket. The
+// coordinator merges them exactly as compute_move merges the trees of
+// its threads. Workers that crash or send incomplete data are ignored.
+//
+// send_root_statistics and receive_root_statistics work on any stream
+// socket, so workers may also be connected over TCP.
+//
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <mcts.h>
+
+namespace MCTS
+{
+namespace distributed
+{
+static const std::uint32_t message_magic = 0x4d435453;  // "MCTS"
+// Larger messages are treated as garbled rather than allocated.
+static const std::uint32_t max_message_children = 1 << 20;
+
+static bool write_all(int fd, const void* data, size_t size)
+{
+	auto bytes = static_cast<const char*>(data);
+	while (size > 0) {
+		auto written = ::write(fd, bytes, size);
+		if (written < 0 && errno == EINTR) {
+			continue;
+		}
+		if (written <= 0) {
+			return false;
+		}
+		bytes += written;
+		size -= written;
+	}
+	return true;
+}
+
+static bool read_all(int fd, void* data, size_t size)
+{
+	auto bytes = static_cast<char*>(data);
+	while (size > 0) {
+		auto count = ::read(fd, bytes, size);
+		if (count < 0 && errno == EINTR) {
+			continue;
+		}
+		if (count <= 0) {
+			return false;
+		}
+		bytes += count;
+		size -= count;
+	}
+	return true;
+}
+
+// One record per root child.
+template<typename Move>
+struct ChildRecord
+{
+	Move move;
+	std::int64_t visits;
+	double wins;
+};
+}
+
+// Sends the merged root statistics of the trees in a compact binary
+// form. Both ends must run on machines with the same byte order.
+template<typename State>
+bool send_root_statistics(int fd, const std::vector<std::unique_ptr<Tree<State>>>& trees)
+{
+	typedef typename State::Move Move;
+	static_assert(std::is_pod<Move>::value, "Moves are sent as raw bytes.");
+
+	RootStatistics<Move> statistics;
+	std::int64_t games_played = 0;
+	for (auto& tree: trees) {
+		games_played += add_root_statistics(*tree, &statistics);
+	}
+
+	std::vector<distributed::ChildRecord<Move>> records;
+	for (auto& item: statistics) {
+		distributed::ChildRecord<Move> record;
+		std::memset(&record, 0, sizeof(record));
+		record.move   = item.first;
+		record.visits = item.second.first;
+		record.wins   = item.second.second;
+		records.push_back(record);
+	}
+
+	std::uint32_t header[2] = {distributed::message_magic, std::uint32_t(records.size())};
+	return distributed::write_all(fd, header, sizeof(header)) &&
+	       distributed::write_all(fd, &games_played, sizeof(games_played)) &&
+	       distributed::write_all(fd, records.data(), records.size() * sizeof(records[0]));
+}
+
+// Reads a message written by send_root_statistics and adds it to
+// statistics. Nothing is added if the message is incomplete.
+template<typename Move>
+bool receive_root_statistics(int fd, RootStatistics<Move>* statistics, long long* games_played)
+{
+	std::uint32_t header[2];
+	std::int64_t games = 0;
+	if ( ! distributed::read_all(fd, header, sizeof(header)) ||
+	     header[0] != distributed::message_magic ||
+	     header[1] > distributed::max_message_children ||
+	     ! distributed::read_all(fd, &games, sizeof(games))) {
+		return false;
+	}
+
+	std::vector<distributed::ChildRecord<Move>> records(header[1]);
+	if ( ! distributed::read_all(fd, records.data(), records.size() * sizeof(records[0]))) {
+		return false;
+	}
+
+	for (auto& record: records) {
+		auto& item = (*statistics)[record.move];
+		item.first  += record.visits;
+		item.second += record.wins;
+	}
+	*games_played += games;
+	return true;
+}
+
+// Computes the best move with number_of_processes worker processes,
+// each running options.number_of_threads threads. If options.max_time
+// is set, workers that have not answered five seconds after it has
+// passed (counted from the start of the call) are killed.
+template<typename State>
+typename State::Move compute_move_distributed(const State root_state,
+                                              const ComputeOptions options,
+                                              int number_of_processes)
+{
+	using namespace std;
+
+	attest(number_of_processes >= 1);
+	attest(root_state.player_to_move == 1 || root_state.player_to_move == 2);
+
+	auto moves = root_state.get_moves();
+	attest(moves.size() > 0);
+	if (moves.size() == 1) {
+		return moves[0];
+	}
+
+	const auto start_time = chrono::steady_clock::now();
+	ComputeOptions job_options = options;
+	job_options.verbose = false;
+
+	struct Worker
+	{
+		pid_t pid;
+		int fd;
+	};
+	vector<Worker> workers;
+
+	for (int p = 0; p < number_of_processes; ++p) {
+		int fds[2];
+		if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+			continue;
+		}
+
+		pid_t pid = ::fork();
+		if (pid == 0) {
+			// Worker process.
+			::close(fds[0]);
+			int status = 1;
+			try {
+				auto trees = compute_trees(root_state, job_options, p * options.number_of_threads);
+				if (send_root_statistics(fds[1], trees)) {
+					status = 0;
+				}
+			}
+			catch (...) {
+			}
+			::close(fds[1]);
+			::_exit(status);
+		}
+
+		::close(fds[1]);
+		if (pid < 0) {
+			::close(fds[0]);
+			continue;
+		}
+		Worker worker = {pid, fds[0]};
+		workers.push_back(worker);
+	}
+
+	// Wait for the results. Every worker sends a single message and then
+	// closes its socket. The deadline is fixed, so messages from some
+	// workers do not extend the wait for the others.
+	const double grace_period = 5.0;
+	const bool has_deadline = options.max_time >= 0;
+	const auto deadline = start_time + chrono::duration_cast<chrono::steady_clock::duration>(
+		chrono::duration<double>(options.max_time + grace_period));
+
+	RootStatistics<typename State::Move> statistics;
+	long long games_played = 0;
+	int successful_workers = 0;
+
+	vector<pollfd> pending;
+	for (auto& worker: workers) {
+		pollfd pfd = {worker.fd, POLLIN, 0};
+		pending.push_back(pfd);
+	}
+	while ( ! pending.empty()) {
+		int timeout_ms = -1;
+		if (has_deadline) {
+			long long remaining_ms = chrono::duration_cast<chrono::milliseconds>(
+				deadline - chrono::steady_clock::now()).count();
+			timeout_ms = int(min(max(remaining_ms, 0LL), 1000000000LL));
+		}
+		int ready = ::poll(pending.data(), pending.size(), timeout_ms);
+		if (ready < 0 && errno == EINTR) {
+			continue;
+		}
+		if (ready <= 0) {
+			// Timeout; give up on the remaining workers.
+			break;
+		}
+
+		for (size_t i = 0; i < pending.size(); ) {
+			if (pending[i].revents != 0) {
+				if (receive_root_statistics(pending[i].fd, &statistics, &games_played)) {
+					successful_workers++;
+				}
+				::close(pending[i].fd);
+				pending.erase(pending.begin() + i);
+			}
+			else {
+				++i;
+			}
+		}
+	}
+
+	for (auto& worker: workers) {
+		for (auto& pfd: pending) {
+			if (pfd.fd == worker.fd) {
+				::kill(worker.pid, SIGKILL);
+				::close(pfd.fd);
+			}
+		}
+		::waitpid(worker.pid, nullptr, 0);
+	}
+
+	if (successful_workers == 0) {
+		throw runtime_error("compute_move_distributed: no worker process returned a result.");
+	}
+
+	if (options.verbose) {
+		cerr << successful_workers << " of " << number_of_processes << " worker processes returned results." << endl;
+	}
+	return best_move_from_statistics(statistics, games_played, options.verbose);
+}
+
+}
+
+#endif
@@ -3,9 +3,16 @@
 #define CATCH_CONFIG_MAIN
 #include <catch.hpp>
 
+#include <future>
+#include <sstream>
+
 #include <mcts.h>
 
 #include "games/go.h"
+#include "games/go_5row.h"
+#include "games/go_bitboard.h"
+#include "games/go_patterns.h"
+#include "games/go_sgf.h"
 
 using namespace std;
 
@@ -114,12 +121,469 @@ TEST_CASE("go3")
 	options.max_time = 1.0;
 	options.verbose = false;
 	auto tree = MCTS::compute_tree(state, options, 1);
-	REQUIRE(tree->has_children());
-	REQUIRE(tree->children.size() == 2);
+	auto root = tree->root();
+	REQUIRE(root->has_children());
+	REQUIRE(tree->children(root).size() == 2);
 	std::set<GoState<M, N>::Move> move_set;
-	move_set.insert(tree->children[0]->move);
-	move_set.insert(tree->children[1]->move);
+	for (auto child: tree->children(root)) {
+		move_set.insert(child->move);
+	}
 	REQUIRE(move_set.find(GoState<M, N>::ij_to_ind(0, 0)) != move_set.end());
 	REQUIRE(move_set.find(GoState<M, N>::ij_to_ind(1, 0)) != move_set.end());
 }
 
+
+TEST_CASE("go_5row")
+{
+	CHECK( ! (std::is_polymorphic<GoState<9, 9>>::value));
+	CHECK( ! (std::is_polymorphic<Go5RowState<9, 9>>::value));
+
+	typedef Go5RowState<9, 9> State;
+	State state;
+	for (int j = 0; j < 4; ++j) {
+		state.do_move(State::ij_to_ind(0, j));
+		state.do_move(State::ij_to_ind(1, j));
+	}
+	CHECK(state.get_winner() == State::empty);
+	CHECK(state.has_moves());
+
+	state.do_move(State::ij_to_ind(0, 4));
+	CHECK(state.get_winner() == State::player1);
+	CHECK( ! state.has_moves());
+	CHECK(state.get_result(2) == 1.0);
+}
+
+TEST_CASE("go_has_moves")
+{
+	// has_moves must agree with get_moves in every position of some
+	// random games.
+	std::mt19937_64 engine(1);
+	for (int game = 0; game < 20; ++game) {
+		GoState<5, 5> state;
+		while (true) {
+			bool has_moves = ! state.get_moves().empty();
+			REQUIRE(state.has_moves() == has_moves);
+			if ( ! has_moves) {
+				break;
+			}
+			state.do_random_move(&engine);
+		}
+	}
+}
+
+TEST_CASE("go_random_move_is_uniform")
+{
+	// All four points are legal on an empty 2x2 board.
+	GoState<2, 2> start;
+	REQUIRE(start.get_moves().size() == 4);
+
+	std::mt19937_64 engine(1);
+	int counts[4] = {0, 0, 0, 0};
+	for (int sample = 0; sample < 4000; ++sample) {
+		auto state = start;
+		state.do_random_move(&engine);
+		for (int p = 0; p < 4; ++p) {
+			if (state.get_pos(p / 2, p % 2) == 1) {
+				counts[p]++;
+			}
+		}
+	}
+	for (int p = 0; p < 4; ++p) {
+		CHECK(counts[p] > 850);
+		CHECK(counts[p] < 1150);
+	}
+}
+
+TEST_CASE("go_pattern_keys")
+{
+	std::mt19937_64 engine(1);
+	for (int game = 0; game < 10; ++game) {
+		GoPatternState<7, 7> state;
+		while (state.has_moves()) {
+			state.do_random_move(&engine);
+
+			int total_weight[2] = {0, 0};
+			for (int i = 0; i < 7; ++i) {
+			for (int j = 0; j < 7; ++j) {
+				auto key = state.get_pattern_key(i, j);
+				REQUIRE(key == state.compute_pattern_key(i, j));
+				for (int player = 1; player <= 2; ++player) {
+					int weight = state.get_pos(i, j) == 0 ? go_pattern_weight(key, player) : 0;
+					REQUIRE(state.get_weight(i, j, player) == weight);
+					total_weight[player - 1] += weight;
+				}
+			}}
+			CHECK(state.get_total_weight(1) == total_weight[0]);
+			CHECK(state.get_total_weight(2) == total_weight[1]);
+		}
+	}
+}
+
+TEST_CASE("go_pattern_capture")
+{
+	static const int M = 5;
+	static const int N = 5;
+	char board[M][N+1] = {"..1..",
+	                      ".1...",
+	                      "..1..",
+	                      ".....",
+	                      "....."};
+	GoPatternState<M, N> start(board);
+	start.player_to_move = 2;
+	start.do_move(GoPatternState<M, N>::ij_to_ind(1, 2));
+
+	// The stone just played is in atari and is always captured.
+	std::mt19937_64 engine(1);
+	for (int sample = 0; sample < 100; ++sample) {
+		auto state = start;
+		state.do_random_move(&engine);
+		CHECK(state.get_pos(1, 3) == 1);
+		CHECK(state.get_pos(1, 2) == 0);
+	}
+}
+
+TEST_CASE("go_area_scoring")
+{
+	static const int M = 3;
+	static const int N = 4;
+	char board[M][N+1] = {".1.2",
+	                      ".1.2",
+	                      ".1.2"};
+	auto state = GoState<M, N>(board);
+
+	// The left column is territory of player 1. The third column
+	// borders both players and belongs to no one.
+	int scores[3];
+	state.get_scores(scores);
+	CHECK(scores[1] == 6);
+	CHECK(scores[2] == 3);
+	CHECK(state.get_player_score(1) == 6);
+	CHECK(state.get_result(2) == 1.0);
+
+	// The stone counts are kept up to date through captures.
+	std::mt19937_64 engine(1);
+	for (int game = 0; game < 10; ++game) {
+		GoState<5, 5> random_state;
+		while (random_state.has_moves()) {
+			random_state.do_random_move(&engine);
+		}
+		char final_board[5][6] = {};
+		for (int i = 0; i < 5; ++i) {
+			for (int j = 0; j < 5; ++j) {
+				final_board[i][j] = ".12"[random_state.get_pos(i, j)];
+			}
+		}
+		int expected[3];
+		GoState<5, 5>(final_board).get_scores(expected);
+		random_state.get_scores(scores);
+		CHECK(scores[1] == expected[1]);
+		CHECK(scores[2] == expected[2]);
+	}
+}
+
+template<unsigned int M, unsigned int N>
+void compare_with_bitboard(int games)
+{
+	std::mt19937_64 engine(1);
+	for (int game = 0; game < games; ++game) {
+		GoState<M, N> state;
+		GoBitboardState<M, N> bitboard_state;
+		while (state.has_moves()) {
+			REQUIRE(bitboard_state.has_moves());
+			auto moves = state.get_moves();
+			REQUIRE((bitboard_state.get_moves() == moves));
+			std::uniform_int_distribution<std::size_t> move_ind(0, moves.size() - 1);
+			auto move = moves[move_ind(engine)];
+			state.do_move(move);
+			bitboard_state.do_move(move);
+		}
+		CHECK( ! bitboard_state.has_moves());
+		for (int i = 0; i < M; ++i) {
+			for (int j = 0; j < N; ++j) {
+				REQUIRE(bitboard_state.get_pos(i, j) == state.get_pos(i, j));
+			}
+		}
+		int scores[3], bitboard_scores[3];
+		state.get_scores(scores);
+		bitboard_state.get_scores(bitboard_scores);
+		CHECK(bitboard_scores[1] == scores[1]);
+		CHECK(bitboard_scores[2] == scores[2]);
+	}
+}
+
+TEST_CASE("go_bitboard")
+{
+	// Same legal moves, captures and scores as GoState in random games.
+	// 4x16 rows need more than one word.
+	compare_with_bitboard<5, 5>(20);
+	compare_with_bitboard<4, 16>(5);
+	compare_with_bitboard<9, 9>(5);
+
+	// Random moves are legal until the game ends.
+	std::mt19937_64 engine(1);
+	GoBitboardState<13, 13> state;
+	while (state.has_moves()) {
+		state.do_random_move(&engine);
+	}
+	int scores[3];
+	state.get_scores(scores);
+	int total_score = scores[1] + scores[2];
+	CHECK(total_score > 13 * 13 / 2);
+}
+
+TEST_CASE("go_shared_state")
+{
+	// A state may be read by several threads at the same time.
+	std::mt19937_64 engine(1);
+	GoState<9, 9> state;
+	for (int ply = 0; ply < 40; ++ply) {
+		state.do_random_move(&engine);
+	}
+	const auto& shared_state = state;
+	auto expected = shared_state.get_moves();
+
+	std::vector<std::future<bool>> results;
+	for (int t = 0; t < 4; ++t) {
+		results.push_back(std::async(std::launch::async, [&shared_state, &expected] ()
+		{
+			bool same = true;
+			for (int repetition = 0; repetition < 100; ++repetition) {
+				same = same && shared_state.get_moves() == expected && shared_state.has_moves();
+			}
+			return same;
+		}));
+	}
+	for (auto& result: results) {
+		CHECK(result.get());
+	}
+}
+
+TEST_CASE("go_sgf_read")
+{
+	std::istringstream in(
+		"(;GM[1]FF[4]SZ[5]KM[6.5]RE[W+R]C[A comment \\] with escapes.]\n"
+		" AB[aa][bb]AW[ee]PL[W]\n"
+		" ;W[cc];B[]\n"
+		" (;W[dd];B[ea])\n"
+		" (;W[ad](;B[ab])))\n"
+		"(;SZ[9];B[ii];W[tt])\n");
+
+	SgfGame game;
+	REQUIRE(read_sgf_game(in, &game));
+	CHECK(game.size == 5);
+	CHECK(game.komi == 6.5);
+	CHECK(game.result == "W+R");
+	CHECK(game.first_player == 2);
+	REQUIRE(game.setup.size() == 3);
+	CHECK(game.setup[1].player == 1);
+	CHECK(game.setup[1].i == 1);
+	CHECK(game.setup[2].player == 2);
+	CHECK(game.setup[2].j == 4);
+	// Only the first variation is followed.
+	REQUIRE(game.moves.size() == 4);
+	CHECK(game.moves[1].player == 1);
+	CHECK(game.moves[1].i == -1);
+	CHECK(game.moves[3].i == 0);
+	CHECK(game.moves[3].j == 4);
+
+	// The next game of the stream.
+	REQUIRE(read_sgf_game(in, &game));
+	CHECK(game.size == 9);
+	REQUIRE(game.moves.size() == 2);
+	CHECK(game.moves[0].i == 8);
+	CHECK(game.moves[1].i == -1);
+	CHECK( ! read_sgf_game(in, &game));
+
+	std::istringstream bad("(;SZ[5];B[aa]");
+	CHECK_THROWS(read_sgf_game(bad, &game));
+}
+
+TEST_CASE("go_sgf_round_trip")
+{
+	typedef GoState<7, 7> State;
+	std::mt19937_64 engine(1);
+	State state;
+	SgfGame game;
+	game.size = 7;
+	game.komi = 5.5;
+	game.result = "B+[1]";
+	for (int ply = 0; ply < 60 && state.has_moves(); ++ply) {
+		auto moves = state.get_moves();
+		auto move = moves[engine() % moves.size()];
+		SgfMove record = {state.player_to_move, -1, -1};
+		if (move != State::pass) {
+			record.i = State::ind_to_ij(move).first;
+			record.j = State::ind_to_ij(move).second;
+		}
+		game.moves.push_back(record);
+		state.do_move(move);
+	}
+
+	std::stringstream stream;
+	write_sgf_game(stream, game);
+	SgfGame read_game;
+	REQUIRE(read_sgf_game(stream, &read_game));
+	CHECK(read_game.size == game.size);
+	CHECK(read_game.komi == game.komi);
+	CHECK(read_game.result == game.result);
+	REQUIRE(read_game.moves.size() == game.moves.size());
+
+	auto positions = replay_sgf_game<State>(read_game);
+	REQUIRE(positions.size() == game.moves.size() + 1);
+	CHECK(positions.back().get_hash() == state.get_hash());
+	CHECK(positions.back().player_to_move == state.player_to_move);
+	CHECK(positions.back().komi == 5.5);
+	CHECK((positions.back().get_moves() == state.get_moves()));
+
+	// The final position as setup stones.
+	stream.str("");
+	stream.clear();
+	write_sgf_game(stream, sgf_game_from_position(state));
+	REQUIRE(read_sgf_game(stream, &read_game));
+	CHECK(read_game.moves.empty());
+	positions = replay_sgf_game<State>(read_game);
+	REQUIRE(positions.size() == 1);
+	bool same_board = true;
+	for (int i = 0; i < 7; ++i) {
+	for (int j = 0; j < 7; ++j) {
+		same_board = same_board && positions[0].get_pos(i, j) == state.get_pos(i, j);
+	}}
+	CHECK(same_board);
+	CHECK(positions[0].player_to_move == state.player_to_move);
+}
+
+TEST_CASE("go_sgf_ko")
+{
+	typedef GoState<5, 5> State;
+	// Black takes the ko at cb. The recapture at bb repeats the position
+	// and is illegal for White.
+	std::istringstream in(
+		"(;SZ[5]AB[ba][ab][bc]AW[ca][bb][cc][db];B[cb])\n"
+		"(;SZ[5]AB[ba][ab][bc]AW[ca][bb][cc][db];B[cb];W[bb])\n"
+		"(;SZ[5]AB[ba][ab][bc]AW[ca][bb][cc][db];B[cb];W[ee];B[ae];W[bb])\n");
+
+	SgfGame game;
+	REQUIRE(read_sgf_game(in, &game));
+	auto positions = replay_sgf_game<State>(game);
+	REQUIRE(positions.size() == 2);
+	CHECK(positions[0].player_to_move == 1);
+	CHECK(positions[1].get_pos(1, 1) == State::empty);
+	CHECK(positions[1].player_to_move == 2);
+	CHECK( ! positions[1].is_move_possible(1, 1));
+
+	REQUIRE(read_sgf_game(in, &game));
+	CHECK_THROWS(replay_sgf_game<State>(game));
+
+	// After an exchange elsewhere the recapture is legal.
+	REQUIRE(read_sgf_game(in, &game));
+	positions = replay_sgf_game<State>(game);
+	REQUIRE(positions.size() == 5);
+	CHECK(positions[4].get_pos(1, 2) == State::empty);
+
+	std::stringstream stream;
+	write_sgf_game(stream, game);
+	SgfGame read_game;
+	REQUIRE(read_sgf_game(stream, &read_game));
+	auto read_positions = replay_sgf_game<State>(read_game);
+	REQUIRE(read_positions.size() == 5);
+	CHECK(read_positions[4].get_hash() == positions[4].get_hash());
+}
+
+TEST_CASE("go_zobrist_hash")
+{
+	// The incrementally updated hash is that of the board, whichever
+	// moves and captures led to it.
+	std::mt19937_64 engine(1);
+	GoState<9, 9> state;
+	for (int ply = 0; ply < 150 && state.has_moves(); ++ply) {
+		state.do_random_move(&engine);
+	}
+	std::uint64_t hash = 0;
+	for (int i = 0; i < 9; ++i) {
+	for (int j = 0; j < 9; ++j) {
+		hash ^= go_zobrist_key(9*i + j, state.get_pos(i, j));
+	}}
+	CHECK(state.compute_hash_value() == hash);
+
+	GoState<3, 3> empty_state;
+	CHECK(empty_state.compute_hash_value() == 0);
+	CHECK(empty_state.compute_hash_value(1, 1, 1) != empty_state.compute_hash_value(1, 1, 2));
+	CHECK(empty_state.compute_hash_value(1, 1, 1) != empty_state.compute_hash_value(1, 2, 1));
+}
+
+TEST_CASE("go_max_depth")
+{
+	// A game that reaches max_depth is over and scored as it stands.
+	static const int M = 5;
+	static const int N = 5;
+	char board[M][N+1] = {
+		"11111",
+		".....",
+		".....",
+		".....",
+		"2...."};
+	GoState<M, N> state(board);
+	REQUIRE(state.has_moves());
+	state.depth = GoState<M, N>::max_depth;
+	CHECK( ! state.has_moves());
+	CHECK(state.get_moves().empty());
+	int scores[3];
+	state.get_scores(scores);
+	REQUIRE(scores[1] == 5);
+	REQUIRE(scores[2] == 1);
+	// get_result is from the point of view of the player who made the
+	// last move, so it is 0 for the player to move if that player wins.
+	CHECK(state.get_result(1) == 0.0);
+	CHECK(state.get_result(2) == 1.0);
+
+	GoBitboardState<9, 9> bitboard_state;
+	bitboard_state.depth = GoBitboardState<9, 9>::max_depth;
+	CHECK( ! bitboard_state.has_moves());
+}
+
+TEST_CASE("go_19x19")
+{
+	typedef GoState<19, 19> State;
+	// Random games end by themselves or at max_depth.
+	State state;
+	auto initial_state = state;
+	std::mt19937_64 engine(1);
+	while (state.has_moves()) {
+		state.do_random_move(&engine);
+	}
+	CHECK(state.depth <= State::max_depth);
+	int scores[3];
+	state.get_scores(scores);
+	int total_score = scores[1] + scores[2];
+	CHECK(total_score > 19 * 19 / 2);
+
+	MCTS::ComputeOptions options;
+	options.number_of_threads = 2;
+	options.max_iterations = 200;
+	auto move = MCTS::compute_move(initial_state, options);
+	CHECK(initial_state.is_move_possible(State::ind_to_ij(move).first, State::ind_to_ij(move).second));
+}
+
+TEST_CASE("go_komi")
+{
+	// Black leads by three points on the board, so a komi above three
+	// gives the game to White.
+	static const int M = 3;
+	static const int N = 4;
+	char board[M][N+1] = {
+		"11.2",
+		"11.2",
+		"11.2"};
+	GoState<M, N> state(board);
+	CHECK(state.get_result(1) == 0.0);
+	CHECK(state.get_result(2) == 1.0);
+	state.komi = 3;
+	CHECK(state.get_result(1) == 0.5);
+	state.komi = 6.5;
+	CHECK(state.get_result(1) == 1.0);
+	CHECK(state.get_result(2) == 0.0);
+
+	GoBitboardState<M, N> bitboard_state(board);
+	bitboard_state.komi = 6.5;
+	CHECK(bitboard_state.get_result(1) == 1.0);
+}
@@ -4,6 +4,10 @@
 #include <catch.hpp>
 
 #include <mcts.h>
+#include <mcts_book.h>
+#ifndef _WIN32
+#include <mcts_distributed.h>
+#endif
 
 #include "games/nim.h"
 
@@ -146,3 +150,569 @@ TEST_CASE("Nim")
 		}
 	}
 }
+
+TEST_CASE("Nim_batch")
+{
+	MCTS::ComputeOptions options;
+	options.max_iterations = 100000;
+
+	vector<NimState> states;
+	vector<int> expected_moves;
+	for (int chips = 1; chips <= 21; ++chips) {
+		if (chips % 4 != 0) {
+			states.push_back(NimState(chips));
+			expected_moves.push_back(chips % 4);
+		}
+	}
+
+	auto moves = MCTS::compute_moves(states, options);
+	REQUIRE(moves.size() == states.size());
+	for (size_t i = 0; i < moves.size(); ++i) {
+		CHECK(moves[i] == expected_moves[i]);
+	}
+}
+
+TEST_CASE("Nim_hybrid")
+{
+	MCTS::ComputeOptions options;
+	options.max_iterations = 25000;
+	options.threads_per_tree = 4;
+	options.sync_interval = 1000;
+
+	for (int chips = 4; chips <= 15; ++chips) {
+		if (chips % 4 != 0) {
+			NimState state(chips);
+			auto move = MCTS::compute_move(state, options);
+			CHECK(move == chips % 4);
+		}
+	}
+
+	// The threads must split evenly into groups.
+	options.number_of_threads = 6;
+	CHECK_THROWS_AS(MCTS::compute_move(NimState(10), options), const std::invalid_argument&);
+}
+
+TEST_CASE("Nim_synchronized_roots")
+{
+	MCTS::ComputeOptions options;
+	options.max_iterations = 25000;
+	options.sync_interval = 500;
+	options.sync_depth = 2;
+
+	for (int chips = 4; chips <= 15; ++chips) {
+		if (chips % 4 != 0) {
+			NimState state(chips);
+			auto move = MCTS::compute_move(state, options);
+			CHECK(move == chips % 4);
+		}
+	}
+}
+
+TEST_CASE("synchronized_trees_only_count_own_games")
+{
+	MCTS::ComputeOptions options;
+	options.number_of_threads = 4;
+	options.max_iterations = 2000;
+	options.sync_interval = 100;
+	options.sync_depth = 2;
+
+	NimState state(10);
+	auto trees = MCTS::compute_trees(state, options);
+	REQUIRE(trees.size() == 4);
+	for (auto& tree: trees) {
+		CHECK(tree->root()->visits() == options.max_iterations);
+		int child_visits = 0;
+		for (auto child: tree->children(tree->root())) {
+			child_visits += child->visits();
+		}
+		CHECK(child_visits == options.max_iterations);
+	}
+}
+
+TEST_CASE("Nim_playouts_per_leaf")
+{
+	MCTS::ComputeOptions options;
+	options.max_iterations = 25000;
+	options.playouts_per_leaf = 4;
+
+	// Every single tree finds these moves for any seed; 21 chips needs
+	// more iterations.
+	for (int chips = 4; chips <= 19; ++chips) {
+		if (chips % 4 != 0) {
+			NimState state(chips);
+			auto move = MCTS::compute_move(state, options);
+			CHECK(move == chips % 4);
+		}
+	}
+
+	auto tree = MCTS::compute_tree(NimState(10), options, 1);
+	CHECK(tree->root()->visits() == options.max_iterations * options.playouts_per_leaf);
+}
+
+TEST_CASE("book_tree")
+{
+	MCTS::ComputeOptions options;
+	options.max_iterations = 20000;
+	NimState state(10);
+	auto tree = MCTS::compute_tree(state, options, 1);
+
+	const char* file_name = "test_book_tree.bin";
+	MCTS::write_book_tree(*tree, file_name, 10);
+	{
+		MCTS::BookTree<NimState::Move> book(file_name);
+		auto root = book.root();
+		REQUIRE(root.is_valid());
+		CHECK(root.visits() == tree->root()->visits());
+		CHECK(root.player_to_move() == state.player_to_move);
+		REQUIRE(root.number_of_children() == tree->children(tree->root()).size());
+		for (auto child: tree->children(tree->root())) {
+			auto book_child = root.find_child(child->move);
+			REQUIRE(book_child.is_valid());
+			CHECK(book_child.visits() == child->visits());
+			CHECK(book_child.wins() == child->wins());
+		}
+		CHECK( ! root.find_child(17).is_valid());
+
+		// Enough games in the book; no search is needed.
+		CHECK(MCTS::compute_move_with_book(state, root, 1000, options) == 2);
+
+		// The position after 10 - 2 - 1 = 7 chips.
+		auto node = root.find_child(2).find_child(1);
+		REQUIRE(node.is_valid());
+		NimState state7(7);
+		CHECK(MCTS::compute_move_with_book(state7, node, 1000000000, options) == 3);
+	}
+	std::remove(file_name);
+}
+
+#ifndef _WIN32
+TEST_CASE("Nim_distributed")
+{
+	MCTS::ComputeOptions options;
+	options.number_of_threads = 2;
+	options.max_iterations = 50000;
+
+	for (int chips = 5; chips <= 11; ++chips) {
+		if (chips % 4 != 0) {
+			NimState state(chips);
+			auto move = MCTS::compute_move_distributed(state, options, 4);
+			CHECK(move == chips % 4);
+		}
+	}
+}
+
+TEST_CASE("distributed_incomplete_message")
+{
+	int fds[2];
+	REQUIRE(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+	// A worker that dies in the middle of a message.
+	std::uint32_t header[2] = {MCTS::distributed::message_magic, 3};
+	REQUIRE(::write(fds[1], header, sizeof(header)) == sizeof(header));
+	::close(fds[1]);
+
+	MCTS::RootStatistics<int> statistics;
+	long long games_played = 0;
+	CHECK( ! MCTS::receive_root_statistics(fds[0], &statistics, &games_played));
+	CHECK(statistics.empty());
+	CHECK(games_played == 0);
+	::close(fds[0]);
+
+	// A garbled size is rejected before anything is allocated.
+	REQUIRE(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+	header[1] = 0xffffffff;
+	std::int64_t games = 10;
+	REQUIRE(::write(fds[1], header, sizeof(header)) == sizeof(header));
+	REQUIRE(::write(fds[1], &games, sizeof(games)) == sizeof(games));
+	::close(fds[1]);
+	CHECK( ! MCTS::receive_root_statistics(fds[0], &statistics, &games_played));
+	CHECK(games_played == 0);
+	::close(fds[0]);
+}
+#endif
+
+TEST_CASE("position_book")
+{
+	MCTS::ComputeOptions options;
+	options.max_iterations = 10000;
+
+	vector<NimState> states;
+	for (int chips = 5; chips <= 7; ++chips) {
+		states.push_back(NimState(chips));
+	}
+	auto statistics = MCTS::compute_root_statistics(states, options);
+	REQUIRE(statistics.size() == states.size());
+
+	// A journal where the last position was cut short.
+	const char* journal_file = "test_position_book.journal";
+	std::remove(journal_file);
+	for (size_t i = 0; i < states.size(); ++i) {
+		MCTS::append_to_position_journal(journal_file, states[i].get_hash(), statistics[i]);
+	}
+	{
+		std::ofstream fout(journal_file, std::ios::binary | std::ios::app);
+		MCTS::book::JournalBlock block = {NimState(9).get_hash(), 3, 0};
+		fout.write(reinterpret_cast<const char*>(&block), sizeof(block));
+	}
+	MCTS::PositionStatistics<NimState::Move> positions;
+	MCTS::read_position_journal(journal_file, &positions);
+	CHECK(positions.size() == states.size());
+
+	// A corrupt block that claims more moves than the file holds ends
+	// the journal without allocating them.
+	{
+		std::ofstream fout(journal_file, std::ios::binary | std::ios::app);
+		MCTS::book::JournalBlock block = {NimState(10).get_hash(), 0xffffffffu, 0};
+		fout.write(reinterpret_cast<const char*>(&block), sizeof(block));
+		fout.write(reinterpret_cast<const char*>(&block), sizeof(block));
+	}
+	MCTS::PositionStatistics<NimState::Move> corrupt_positions;
+	MCTS::read_position_journal(journal_file, &corrupt_positions);
+	CHECK(corrupt_positions.size() == states.size());
+	std::remove(journal_file);
+
+	const char* book_file = "test_position_book.bin";
+	MCTS::write_position_book(positions, book_file);
+	{
+		MCTS::PositionBook<NimState::Move> book(book_file);
+		for (size_t i = 0; i < states.size(); ++i) {
+			MCTS::RootStatistics<NimState::Move> book_statistics;
+			long long games_played = 0;
+			REQUIRE(book.find(states[i].get_hash(), &book_statistics, &games_played));
+			CHECK(book_statistics == statistics[i]);
+			CHECK(MCTS::compute_move_with_book(states[i], book, options) == (5 + int(i)) % 4);
+		}
+
+		MCTS::RootStatistics<NimState::Move> book_statistics;
+		long long games_played = 0;
+		CHECK( ! book.find(NimState(9).get_hash(), &book_statistics, &games_played));
+	}
+	std::remove(book_file);
+}
+
+TEST_CASE("write_tree")
+{
+	MCTS::ComputeOptions options;
+	options.max_iterations = 1000;
+	auto tree = MCTS::compute_tree(NimState(6), options, 1);
+
+	stringstream text;
+	tree->write_tree(text, MCTS::TREE_TEXT, 3);
+	CHECK(text.str() == tree->tree_to_string(3));
+
+	// Every line is one node; the root and its children are always
+	// visited more than 10 times.
+	stringstream json;
+	tree->write_tree(json, MCTS::TREE_JSON_LINES, 2, 10);
+	string line;
+	int lines = 0;
+	while (getline(json, line)) {
+		CHECK(line.front() == '{');
+		CHECK(line.back() == '}');
+		lines++;
+	}
+	CHECK(lines == 1 + int(tree->children(tree->root()).size()));
+
+	stringstream dot;
+	tree->write_tree(dot, MCTS::TREE_GRAPHVIZ, 2);
+	CHECK(dot.str().find("digraph tree {") == 0);
+	CHECK(dot.str().find("n0 -> n1;") != string::npos);
+}
+
+TEST_CASE("lazy_expansion")
+{
+	MCTS::ComputeOptions options;
+	options.max_iterations = 1000;
+	auto tree = MCTS::compute_tree(NimState(15), options, 1);
+
+	// Nodes visited once have not generated their moves.
+	std::vector<MCTS::Node<NimState>*> stack(1, tree->root());
+	int leaves = 0;
+	while ( ! stack.empty()) {
+		auto node = stack.back();
+		stack.pop_back();
+		if (node->visits() == 1) {
+			CHECK( ! node->is_expanded());
+			CHECK( ! node->has_untried_moves());
+			CHECK( ! node->has_children());
+			leaves++;
+		}
+		for (auto child: tree->children(node)) {
+			stack.push_back(child);
+		}
+	}
+	CHECK(leaves > 0);
+}
+
+TEST_CASE("Nim_progressive_widening")
+{
+	MCTS::ComputeOptions options;
+	options.max_iterations = 100000;
+	options.progressive_widening_coefficient = 1.0;
+	options.progressive_widening_exponent = 0.5;
+
+	for (int chips = 4; chips <= 21; ++chips) {
+		if (chips % 4 != 0) {
+			NimState state(chips);
+			auto move = MCTS::compute_move(state, options);
+			CHECK(move == chips % 4);
+		}
+	}
+
+	// The second child is added once the root has 4 visits
+	// (1 * 4^0.5 = 2), i.e. in the 5th iteration.
+	options.max_iterations = 4;
+	auto tree = MCTS::compute_tree(NimState(15), options, 1);
+	CHECK(tree->children(tree->root()).size() == 1);
+	options.max_iterations = 5;
+	tree = MCTS::compute_tree(NimState(15), options, 1);
+	CHECK(tree->children(tree->root()).size() == 2);
+	CHECK(tree->root()->get_number_of_children() == 2);
+
+	// Copied subtrees keep their child counts.
+	options.max_iterations = 1000;
+	tree = MCTS::compute_tree(NimState(15), options, 1);
+	auto root = tree->root();
+	auto subtree = tree->subtree(root, NimState(15));
+	CHECK(subtree->root()->get_number_of_children() == root->get_number_of_children());
+}
+
+TEST_CASE("Nim_expansion_threshold")
+{
+	MCTS::ComputeOptions options;
+	options.max_iterations = 100000;
+	options.expansion_threshold = 8;
+
+	for (int chips = 4; chips <= 21; ++chips) {
+		if (chips % 4 != 0) {
+			NimState state(chips);
+			auto move = MCTS::compute_move(state, options);
+			CHECK(move == chips % 4);
+		}
+	}
+
+	options.max_iterations = 10000;
+	options.expansion_threshold = 1;
+	auto nodes1 = MCTS::compute_tree(NimState(21), options, 1)->size();
+	options.expansion_threshold = 8;
+	auto nodes8 = MCTS::compute_tree(NimState(21), options, 1)->size();
+	auto four_times_nodes8 = 4 * nodes8;
+	CHECK(four_times_nodes8 < nodes1);
+}
+
+TEST_CASE("compact_tree")
+{
+	CHECK(sizeof(MCTS::Node<NimState>) == 32);
+
+	MCTS::ComputeOptions options;
+	options.max_iterations = 100000;
+	auto tree = MCTS::compute_tree(NimState(21), options, 1);
+
+	// The tree spans several chunks; every node can be reached from the
+	// root and knows its parent.
+	size_t nodes = 0;
+	std::vector<MCTS::Node<NimState>*> stack(1, tree->root());
+	while ( ! stack.empty()) {
+		auto node = stack.back();
+		stack.pop_back();
+		nodes++;
+		for (auto child: tree->children(node)) {
+			CHECK(tree->parent(child) == node);
+			stack.push_back(child);
+		}
+	}
+	CHECK(nodes == tree->size());
+	CHECK( ! tree->parent(tree->root()));
+}
+
+TEST_CASE("atomic_node_statistics")
+{
+	MCTS::Tree<NimState> tree(NimState(10));
+	auto root = tree.root();
+
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 8; ++t) {
+		threads.emplace_back([root] ()
+		{
+			for (int i = 0; i < 10000; ++i) {
+				root->update(0.5);
+				root->update(1.0, 2);
+			}
+		});
+	}
+	for (auto& thread: threads) {
+		thread.join();
+	}
+
+	int visits;
+	double wins;
+	root->get_statistics(&visits, &wins);
+	CHECK(visits == 8 * 10000 * 3);
+	CHECK(wins == 8 * 10000 * 1.5);
+
+	root->add_statistics(-visits, -wins);
+	CHECK(root->visits() == 0);
+	CHECK(root->wins() == 0);
+
+	// A search stops before the visits can overflow.
+	root->add_statistics(MCTS::Node<NimState>::max_visits / 2, 0);
+	MCTS::ComputeOptions options;
+	options.max_iterations = 1000;
+	MCTS::search_tree(&tree, NimState(10), options, 1);
+	CHECK(root->visits() == MCTS::Node<NimState>::max_visits / 2);
+}
+
+TEST_CASE("search_handle")
+{
+	MCTS::ComputeOptions options;
+	options.number_of_threads = 4;
+	options.max_iterations = -1;
+	options.max_time = -1;
+
+	// There is no move before a search has been started.
+	MCTS::SearchHandle<NimState> search;
+	CHECK_THROWS_AS(search.wait(), const std::invalid_argument&);
+	CHECK_THROWS_AS(search.get_best_move(), const std::invalid_argument&);
+
+	// Without a budget, the search runs until it is stopped.
+	search.start(NimState(10), options);
+	long long games_played = 0;
+	while (games_played < 10000) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		search.get_root_statistics(&games_played);
+	}
+	CHECK( ! search.is_finished());
+	CHECK(search.get_best_move() == 2);
+
+	search.stop();
+	CHECK(search.wait() == 2);
+	CHECK(search.is_finished());
+
+	// A new search replaces the old one.
+	options.max_iterations = 10000;
+	search.start(NimState(10), options);
+	search.start(NimState(7), options);
+	CHECK(search.wait() == 3);
+	search.get_root_statistics(&games_played);
+	CHECK(games_played == options.number_of_threads * options.max_iterations);
+
+	// Positions with a single move are not searched.
+	search.start(NimState(1), options);
+	CHECK(search.is_finished());
+	CHECK(search.wait() == 1);
+}
+
+TEST_CASE("search_progress")
+{
+	MCTS::ComputeOptions options;
+	options.number_of_threads = 4;
+	options.max_iterations = 10000;
+	options.progress_interval = 1000;
+	options.progress_time = 0;
+
+	std::vector<MCTS::SearchProgress<NimState::Move>> reports;
+	MCTS::SearchHandle<NimState> search;
+	search.start(NimState(10), options,
+		[&reports] (const MCTS::SearchProgress<NimState::Move>& progress)
+		{
+			reports.push_back(progress);
+		});
+	CHECK(search.wait() == 2);
+
+	REQUIRE(reports.size() == 11);
+	for (size_t i = 1; i < reports.size(); ++i) {
+		CHECK(reports[i].games_played >= reports[i - 1].games_played);
+		CHECK(reports[i].tree_size >= reports[i - 1].tree_size);
+		CHECK(reports[i].finished == (i == reports.size() - 1));
+	}
+
+	auto& last = reports.back();
+	CHECK(last.games_played == options.number_of_threads * options.max_iterations);
+	CHECK(last.games_per_second > 0);
+	CHECK(last.root_statistics.size() == 3);
+	REQUIRE( ! last.principal_variation.empty());
+	CHECK(last.principal_variation[0].move == 2);
+}
+
+TEST_CASE("principal_variation")
+{
+	MCTS::ComputeOptions options;
+	options.number_of_threads = 4;
+	options.max_iterations = 10000;
+	auto trees = MCTS::compute_trees(NimState(10), options);
+
+	auto variation = MCTS::principal_variation(trees, 3);
+	REQUIRE(variation.size() == 3);
+	CHECK(variation[0].move == 2);
+	// 8 chips left; the reply does not matter, but the answer to it does.
+	int reply_and_answer = variation[1].move + variation[2].move;
+	CHECK(reply_and_answer == 4);
+
+	// The visits are summed over the trees.
+	MCTS::RootStatistics<NimState::Move> statistics;
+	for (auto& tree: trees) {
+		MCTS::add_root_statistics(*tree, &statistics);
+	}
+	CHECK(variation[0].visits == statistics[2].first);
+	CHECK(variation[0].wins == statistics[2].second);
+	for (size_t i = 1; i < variation.size(); ++i) {
+		CHECK(variation[i].visits <= variation[i - 1].visits);
+	}
+
+	// The whole line ends when the game does.
+	auto full_variation = MCTS::principal_variation(trees);
+	int chips = 10;
+	for (auto& step: full_variation) {
+		chips -= step.move;
+	}
+	CHECK(chips >= 0);
+	CHECK(full_variation.size() > 3);
+}
+
+TEST_CASE("tree_reuse")
+{
+	MCTS::ComputeOptions options;
+	options.max_iterations = 10000;
+	auto tree = MCTS::compute_tree(NimState(10), options, 1);
+
+	NimState state(10);
+	state.do_move(2);
+	auto node = tree->find_child(tree->root(), 2);
+	REQUIRE(node);
+	auto subtree = tree->subtree(node, state);
+
+	// The subtree has the same nodes and statistics below its root.
+	CHECK(subtree->root()->visits() == node->visits());
+	CHECK(subtree->root()->wins() == node->wins());
+	CHECK(subtree->children(subtree->root()).size() == tree->children(node).size());
+	size_t nodes = 0;
+	std::vector<MCTS::Node<NimState>*> stack(1, node);
+	while ( ! stack.empty()) {
+		auto current = stack.back();
+		stack.pop_back();
+		nodes++;
+		for (auto child: tree->children(current)) {
+			stack.push_back(child);
+		}
+	}
+	CHECK(subtree->size() == nodes);
+	for (auto child: tree->children(node)) {
+		auto copy = subtree->find_child(subtree->root(), child->move);
+		REQUIRE(copy);
+		CHECK(copy->visits() == child->visits());
+		CHECK(subtree->parent(copy) == subtree->root());
+	}
+
+	// A search continues from the trees of the previous one.
+	options.number_of_threads = 2;
+	options.max_iterations = 1000;
+	MCTS::SearchHandle<NimState> search;
+	search.start(NimState(10), options);
+	search.wait();
+	state.do_move(1);
+	search.start_after_moves({2, 1}, state, options);
+	CHECK(search.wait() == 3);
+	long long games_played = 0;
+	search.get_root_statistics(&games_played);
+	CHECK(games_played > options.number_of_threads * options.max_iterations);
+}